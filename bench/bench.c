@@ -0,0 +1,214 @@
+/*-
+ * Copyright (c) 2019 Henning Matyschok
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+/*
+ * Micro-benchmarks for cobj(3).
+ *
+ * Results are written as CSV or, with -j, as a JSON array to
+ * stdout, one record per benchmark and thread count.
+ */
+
+struct bench_thread {
+	pthread_t	bt_tid;
+	bench_fn_t	*bt_fn;
+	void		*bt_arg;
+	int		bt_thr;
+	u_long		bt_iters;
+	double		bt_t0;
+	double		bt_t1;
+};
+
+volatile int bench_sink;
+
+static int bench_json;
+static int bench_records;
+
+static pthread_barrier_t bench_start;
+static pthread_barrier_t bench_stop;
+
+static double
+bench_now(void)
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((double)ts.tv_sec * 1e9 + (double)ts.tv_nsec);
+}
+
+static void *
+bench_thread_main(void *arg)
+{
+	struct bench_thread *bt;
+
+	bt = arg;
+
+	(void)pthread_barrier_wait(&bench_start);
+	bt->bt_t0 = bench_now();
+	(*bt->bt_fn)(bt->bt_arg, bt->bt_thr, bt->bt_iters);
+	bt->bt_t1 = bench_now();
+	(void)pthread_barrier_wait(&bench_stop);
+
+	return (NULL);
+}
+
+double
+bench_threads(int nthreads, bench_fn_t *fn, void *arg, u_long iters)
+{
+	struct bench_thread *bt;
+	double t0, t1;
+	int i;
+
+	if ((bt = calloc(nthreads, sizeof(*bt))) == NULL)
+		err(EX_OSERR, "calloc");
+
+	(void)pthread_barrier_init(&bench_start, NULL, nthreads + 1);
+	(void)pthread_barrier_init(&bench_stop, NULL, nthreads + 1);
+
+	for (i = 0; i < nthreads; i++) {
+		bt[i].bt_fn = fn;
+		bt[i].bt_arg = arg;
+		bt[i].bt_thr = i;
+		bt[i].bt_iters = iters;
+
+		if (pthread_create(&bt[i].bt_tid, NULL,
+		    bench_thread_main, &bt[i]) != 0)
+			errx(EX_OSERR, "pthread_create failed");
+	}
+
+	(void)pthread_barrier_wait(&bench_start);
+	(void)pthread_barrier_wait(&bench_stop);
+
+	/*
+	 * From the first thread starting to the last one
+	 * finishing.
+	 */
+	t0 = bt[0].bt_t0;
+	t1 = bt[0].bt_t1;
+	for (i = 0; i < nthreads; i++) {
+		(void)pthread_join(bt[i].bt_tid, NULL);
+		if (bt[i].bt_t0 < t0)
+			t0 = bt[i].bt_t0;
+		if (bt[i].bt_t1 > t1)
+			t1 = bt[i].bt_t1;
+	}
+
+	(void)pthread_barrier_destroy(&bench_start);
+	(void)pthread_barrier_destroy(&bench_stop);
+	free(bt);
+
+	return (t1 - t0);
+}
+
+void
+bench_report(const char *name, int nthreads, u_long ops, double ns)
+{
+
+	if (bench_json)
+		(void)printf("%s\n  {\"benchmark\": \"%s\", \"threads\": %d, "
+		    "\"ops\": %lu, \"ns_per_op\": %.2f, \"mops_per_sec\": %.2f}",
+		    bench_records > 0 ? "," : "[", name, nthreads, ops,
+		    ns / (double)ops, (double)ops * 1e3 / ns);
+	else
+		(void)printf("%s,%d,%lu,%.2f,%.2f\n", name, nthreads, ops,
+		    ns / (double)ops, (double)ops * 1e3 / ns);
+
+	(void)fflush(stdout);
+	bench_records++;
+}
+
+static void
+usage(void)
+{
+
+	(void)fprintf(stderr, "usage: cobj_bench [-j] [-n iterations] [-t threads]\n");
+	exit(EX_USAGE);
+}
+
+int
+main(int argc, char *argv[])
+{
+	u_long iters;
+	int maxthreads;
+	int ch;
+
+	iters = 1000000;
+
+	if ((maxthreads = (int)sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+		maxthreads = 1;
+
+	while ((ch = getopt(argc, argv, "jn:t:")) != -1) {
+		switch (ch) {
+		case 'j':
+			bench_json = 1;
+			break;
+		case 'n':
+			iters = strtoul(optarg, NULL, 10);
+			break;
+		case 't':
+			maxthreads = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if (iters == 0 || maxthreads < 1)
+		usage();
+
+	if (!bench_json)
+		(void)printf("benchmark,threads,ops,ns_per_op,mops_per_sec\n");
+
+	bench_dispatch(iters, maxthreads);
+	bench_lifecycle(iters, maxthreads);
+	bench_zone(iters, maxthreads);
+	bench_batch(iters, maxthreads);
+	bench_ic(iters, maxthreads);
+	bench_super(iters, maxthreads);
+	bench_async(iters, maxthreads);
+	bench_snap(iters, maxthreads);
+	bench_compact(iters, maxthreads);
+	bench_vector(iters, maxthreads);
+	bench_thunk(iters, maxthreads);
+	bench_queue(iters, maxthreads);
+
+	if (bench_json)
+		(void)printf("%s]\n", bench_records > 0 ? "\n" : "[");
+
+	exit(EX_OK);
+}
@@ -0,0 +1,73 @@
+/*-
+ * Copyright (c) 2019 Henning Matyschok
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+/*
+ * Body of a benchmark, called once per thread with
+ * the thread number and the number of iterations.
+ */
+typedef void bench_fn_t(void *arg, int thr, u_long iters);
+
+/*
+ * Run fn on nthreads threads released at the same
+ * time and return the elapsed wall clock time in ns.
+ */
+double bench_threads(int nthreads, bench_fn_t *fn, void *arg, u_long iters);
+
+/*
+ * Results stored here can't be optimized away.
+ */
+extern volatile int bench_sink;
+
+/*
+ * Emit one result record.
+ */
+void bench_report(const char *name, int nthreads, u_long ops, double ns);
+
+/*
+ * Benchmarks.
+ */
+void bench_lifecycle(u_long iters, int maxthreads);
+void bench_zone(u_long iters, int maxthreads);
+void bench_batch(u_long iters, int maxthreads);
+void bench_dispatch(u_long iters, int maxthreads);
+void bench_queue(u_long iters, int maxthreads);
+void bench_ic(u_long iters, int maxthreads);
+void bench_super(u_long iters, int maxthreads);
+void bench_async(u_long iters, int maxthreads);
+void bench_snap(u_long iters, int maxthreads);
+void bench_compact(u_long iters, int maxthreads);
+void bench_vector(u_long iters, int maxthreads);
+void bench_thunk(u_long iters, int maxthreads);
+
+/*
+ * C++ baseline, in bench_cxx.cc.
+ */
+bench_fn_t bench_cxx_virtual;
+
+#endif /* _BENCH_H_ */
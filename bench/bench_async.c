@@ -0,0 +1,180 @@
+/*-
+ * Copyright (c) 2019 Henning Matyschok
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <stdlib.h>
+#include <sysexits.h>
+
+#include <libcobj.h>
+
+#include "bench.h"
+#include "bench_if.h"
+
+/*
+ * Asynchronous calls on the work-stealing pool: every thread fans
+ * out a burst of calls over objects of its own and waits for all
+ * of them, the same burst ordered on a single object, and single
+ * calls waited for right away, for the round trip latency.
+ */
+
+#define BENCH_FANOUT	64
+
+struct bench_aobj {
+	COBJ_FIELDS;
+	int	ba_state;
+};
+
+static int
+bench_async_step(cobj_t o, int arg)
+{
+	struct bench_aobj *ba = (struct bench_aobj *)o;
+
+	return (ba->ba_state += arg);
+}
+
+static cobj_method_t bench_async_methods[] = {
+	COBJ_METHOD(bench_step, bench_async_step),
+	COBJ_METHOD_END
+};
+
+DEFINE_CLASS_0(bench_async, bench_async_class, bench_async_methods,
+    sizeof(struct bench_aobj));
+
+static void
+bench_async_fanout(void *arg, int thr, u_long iters)
+{
+	cobj_future_t f[BENCH_FANOUT];
+	cobj_t *objs;
+	u_long i;
+	int j;
+
+	objs = ((cobj_t **)arg)[thr];
+
+	for (i = 0; i < iters; i += BENCH_FANOUT) {
+		for (j = 0; j < BENCH_FANOUT; j++)
+			f[j] = BENCH_STEP_ASYNC(objs[j], 1);
+		for (j = 0; j < BENCH_FANOUT; j++) {
+			if (f[j] == NULL)
+				errx(EX_SOFTWARE, "BENCH_STEP_ASYNC failed");
+			bench_sink = bench_step_await(f[j]);
+		}
+	}
+}
+
+/*
+ * All calls go to the first object, they run one after
+ * another without the object being locked.
+ */
+static void
+bench_async_ordered(void *arg, int thr, u_long iters)
+{
+	cobj_future_t f[BENCH_FANOUT];
+	cobj_t o;
+	u_long i;
+	int j, start;
+
+	o = ((cobj_t **)arg)[thr][0];
+	start = ((struct bench_aobj *)o)->ba_state;
+
+	for (i = 0; i < iters; i += BENCH_FANOUT) {
+		for (j = 0; j < BENCH_FANOUT; j++)
+			f[j] = BENCH_STEP_ASYNC_ORDERED(o, 1);
+		for (j = 0; j < BENCH_FANOUT; j++) {
+			if (f[j] == NULL)
+				errx(EX_SOFTWARE, "BENCH_STEP_ASYNC_ORDERED failed");
+			if (bench_step_await(f[j]) != start + (int)i + j + 1)
+				errx(EX_SOFTWARE, "ordered calls out of order");
+		}
+	}
+}
+
+static void
+bench_async_roundtrip(void *arg, int thr, u_long iters)
+{
+	cobj_future_t f;
+	cobj_t o;
+
+	o = ((cobj_t **)arg)[thr][0];
+
+	while (iters-- > 0) {
+		if ((f = BENCH_STEP_ASYNC(o, 1)) == NULL)
+			errx(EX_SOFTWARE, "BENCH_STEP_ASYNC failed");
+		bench_sink = bench_step_await(f);
+	}
+}
+
+void
+bench_async(u_long iters, int maxthreads)
+{
+	cobj_t **objs, pool, prev;
+	int i, j, n;
+
+	if ((pool = cobj_pool_create(0)) == NULL)
+		errx(EX_OSERR, "cobj_pool_create failed");
+	prev = cobj_exec_set_default(pool);
+
+	if ((objs = calloc(maxthreads, sizeof(*objs))) == NULL)
+		err(EX_OSERR, "calloc");
+
+	for (i = 0; i < maxthreads; i++) {
+		if ((objs[i] = calloc(BENCH_FANOUT, sizeof(cobj_t))) == NULL)
+			err(EX_OSERR, "calloc");
+		for (j = 0; j < BENCH_FANOUT; j++) {
+			if ((objs[i][j] = cobj_create(&bench_async_class)) == NULL)
+				errx(EX_OSERR, "cobj_create failed");
+		}
+	}
+
+	iters = (iters + BENCH_FANOUT - 1) / BENCH_FANOUT * BENCH_FANOUT;
+
+	for (n = 1;; n *= 2) {
+		if (n > maxthreads)
+			n = maxthreads;
+
+		bench_report("async_fanout", n, iters * n,
+		    bench_threads(n, bench_async_fanout, objs, iters));
+		bench_report("async_fanout_ordered", n, iters * n,
+		    bench_threads(n, bench_async_ordered, objs, iters));
+		bench_report("async_roundtrip", n, iters / BENCH_FANOUT * n,
+		    bench_threads(n, bench_async_roundtrip, objs,
+		    iters / BENCH_FANOUT));
+
+		if (n == maxthreads)
+			break;
+	}
+
+	(void)cobj_exec_set_default(prev);
+	(void)cobj_pool_destroy(pool);
+
+	for (i = 0; i < maxthreads; i++) {
+		for (j = 0; j < BENCH_FANOUT; j++)
+			(void)cobj_delete(objs[i][j]);
+		free(objs[i]);
+	}
+	free(objs);
+}
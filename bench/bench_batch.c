@@ -0,0 +1,253 @@
+/*-
+ * Copyright (c) 2019 Henning Matyschok
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+
+#include <libcobj.h>
+
+#include "bench.h"
+#include "bench_if.h"
+
+/*
+ * Dispatch over an array of objects of mixed classes, one
+ * wrapper call per object against the generated batch
+ * wrappers, on the array as is and grouped by class. Also
+ * repeated calls on one object, through the wrapper and
+ * through a bound method.
+ */
+
+#define BENCH_NOBJS	1024
+#define BENCH_NKINDS	4
+
+struct bench_bobj {
+	COBJ_FIELDS;
+	int	bb_state;
+};
+
+static int
+bench_step_add(cobj_t o, int arg)
+{
+	struct bench_bobj *bb = (struct bench_bobj *)o;
+
+	return (bb->bb_state += arg);
+}
+
+static int
+bench_step_sub(cobj_t o, int arg)
+{
+	struct bench_bobj *bb = (struct bench_bobj *)o;
+
+	return (bb->bb_state -= arg);
+}
+
+static int
+bench_step_xor(cobj_t o, int arg)
+{
+	struct bench_bobj *bb = (struct bench_bobj *)o;
+
+	return (bb->bb_state ^= arg);
+}
+
+static int
+bench_step_shl(cobj_t o, int arg)
+{
+	struct bench_bobj *bb = (struct bench_bobj *)o;
+
+	return (bb->bb_state = (bb->bb_state << 1) + arg);
+}
+
+static cobj_method_t bench_add_methods[] = {
+	COBJ_METHOD(bench_step, bench_step_add),
+	COBJ_METHOD_END
+};
+
+static cobj_method_t bench_sub_methods[] = {
+	COBJ_METHOD(bench_step, bench_step_sub),
+	COBJ_METHOD_END
+};
+
+static cobj_method_t bench_xor_methods[] = {
+	COBJ_METHOD(bench_step, bench_step_xor),
+	COBJ_METHOD_END
+};
+
+static cobj_method_t bench_shl_methods[] = {
+	COBJ_METHOD(bench_step, bench_step_shl),
+	COBJ_METHOD_END
+};
+
+DEFINE_CLASS_0(bench_add, bench_add_class, bench_add_methods,
+    sizeof(struct bench_bobj));
+DEFINE_CLASS_0(bench_sub, bench_sub_class, bench_sub_methods,
+    sizeof(struct bench_bobj));
+DEFINE_CLASS_0(bench_xor, bench_xor_class, bench_xor_methods,
+    sizeof(struct bench_bobj));
+DEFINE_CLASS_0(bench_shl, bench_shl_class, bench_shl_methods,
+    sizeof(struct bench_bobj));
+
+static cobj_class_t bench_kinds[BENCH_NKINDS] = {
+	&bench_add_class, &bench_sub_class,
+	&bench_xor_class, &bench_shl_class,
+};
+
+/*
+ * Call the wrapper on every object, one at a time.
+ */
+static void
+bench_batch_single(void *arg, int thr, u_long iters)
+{
+	cobj_t *objs;
+	u_long i;
+	int j;
+
+	objs = ((cobj_t **)arg)[thr];
+
+	for (i = 0; i < iters; i += BENCH_NOBJS) {
+		for (j = 0; j < BENCH_NOBJS; j++)
+			(void)BENCH_STEP(objs[j], 1);
+	}
+}
+
+/*
+ * Call the batch wrapper on the whole array.
+ */
+static void
+bench_batch_batch(void *arg, int thr, u_long iters)
+{
+	cobj_t *objs;
+	u_long i;
+
+	objs = ((cobj_t **)arg)[thr];
+
+	for (i = 0; i < iters; i += BENCH_NOBJS)
+		BENCH_STEP_BATCH(objs, BENCH_NOBJS, NULL, 1);
+}
+
+/*
+ * Call the wrapper on the same object over and over.
+ */
+static void
+bench_batch_wrapper(void *arg, int thr, u_long iters)
+{
+	cobj_t o;
+
+	o = ((cobj_t **)arg)[thr][0];
+
+	while (iters-- > 0)
+		(void)BENCH_STEP(o, 1);
+}
+
+/*
+ * Resolve the method once and call it directly.
+ */
+static void
+bench_batch_bound(void *arg, int thr, u_long iters)
+{
+	bench_step_t *step;
+	u_long gen;
+	cobj_t o;
+
+	o = ((cobj_t **)arg)[thr][0];
+
+	if ((step = bench_step_bind(o, &gen)) == NULL)
+		errx(EX_SOFTWARE, "bench_step_bind failed");
+
+	while (iters-- > 0)
+		(void)(*step)(o, 1);
+
+	if (!COBJ_BOUND(o, gen))
+		errx(EX_SOFTWARE, "bound method went stale");
+}
+
+void
+bench_batch(u_long iters, int maxthreads)
+{
+	cobj_t **mixed, **sorted;
+	u_int seed;
+	int i, j, n;
+
+	if ((mixed = calloc(maxthreads, sizeof(*mixed))) == NULL ||
+	    (sorted = calloc(maxthreads, sizeof(*sorted))) == NULL)
+		err(EX_OSERR, "calloc");
+
+	/*
+	 * Every thread gets its own objects, of randomly
+	 * interleaved classes, and a copy grouped by class.
+	 */
+	seed = 1;
+	for (i = 0; i < maxthreads; i++) {
+		if ((mixed[i] = calloc(BENCH_NOBJS, sizeof(cobj_t))) == NULL ||
+		    (sorted[i] = calloc(BENCH_NOBJS, sizeof(cobj_t))) == NULL)
+			err(EX_OSERR, "calloc");
+
+		for (j = 0; j < BENCH_NOBJS; j++) {
+			mixed[i][j] = cobj_create(
+			    bench_kinds[rand_r(&seed) % BENCH_NKINDS]);
+			if (mixed[i][j] == NULL)
+				errx(EX_OSERR, "cobj_create failed");
+		}
+
+		memcpy(sorted[i], mixed[i], BENCH_NOBJS * sizeof(cobj_t));
+		cobj_sort_by_ops(sorted[i], BENCH_NOBJS);
+	}
+
+	iters = (iters + BENCH_NOBJS - 1) / BENCH_NOBJS * BENCH_NOBJS;
+
+	for (n = 1;; n *= 2) {
+		if (n > maxthreads)
+			n = maxthreads;
+
+		bench_report("dispatch_single_mixed", n, iters * n,
+		    bench_threads(n, bench_batch_single, mixed, iters));
+		bench_report("dispatch_batch_mixed", n, iters * n,
+		    bench_threads(n, bench_batch_batch, mixed, iters));
+		bench_report("dispatch_single_sorted", n, iters * n,
+		    bench_threads(n, bench_batch_single, sorted, iters));
+		bench_report("dispatch_batch_sorted", n, iters * n,
+		    bench_threads(n, bench_batch_batch, sorted, iters));
+		bench_report("dispatch_wrapper_mono", n, iters * n,
+		    bench_threads(n, bench_batch_wrapper, mixed, iters));
+		bench_report("dispatch_bound_mono", n, iters * n,
+		    bench_threads(n, bench_batch_bound, mixed, iters));
+
+		if (n == maxthreads)
+			break;
+	}
+
+	for (i = 0; i < maxthreads; i++) {
+		for (j = 0; j < BENCH_NOBJS; j++)
+			(void)cobj_delete(mixed[i][j]);
+		free(mixed[i]);
+		free(sorted[i]);
+	}
+	free(mixed);
+	free(sorted);
+}
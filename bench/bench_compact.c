@@ -0,0 +1,167 @@
+/*-
+ * Copyright (c) 2019 Henning Matyschok
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sysexits.h>
+
+#include <libcobj.h>
+
+#include "bench.h"
+#include "bench_if.h"
+
+/*
+ * Tiny objects of four classes, interleaved in one arena, called
+ * once each by walking the arena and through an array of pointers
+ * to them. The records are named after the object header the
+ * library was built with, see COBJ_COMPACT, which is what a run of
+ * another build is compared with; the bytes an object takes in the
+ * arena are printed along with them.
+ */
+
+#define BENCH_COMPACT_CLASSES	4
+
+#if !defined(COBJ_COMPACT)
+#define BENCH_COMPACT_HDR	"ptr"
+#elif COBJ_COMPACT == 16
+#define BENCH_COMPACT_HDR	"idx16"
+#else
+#define BENCH_COMPACT_HDR	"idx32"
+#endif
+
+struct bench_tiny {
+	COBJ_FIELDS;
+	int	bt_state;
+};
+
+static int
+bench_tiny_step(cobj_t o, int arg)
+{
+
+	return (((struct bench_tiny *)o)->bt_state += arg);
+}
+
+static int
+bench_tiny_step2(cobj_t o, int arg)
+{
+
+	return (((struct bench_tiny *)o)->bt_state += 2 * arg);
+}
+
+static cobj_method_t bench_tiny0_methods[] = {
+	COBJ_METHOD(bench_step, bench_tiny_step),
+	COBJ_METHOD_END
+};
+
+static cobj_method_t bench_tiny1_methods[] = {
+	COBJ_METHOD(bench_step, bench_tiny_step2),
+	COBJ_METHOD_END
+};
+
+DEFINE_CLASS_0(bench_tiny0, bench_tiny0_class, bench_tiny0_methods,
+    sizeof(struct bench_tiny));
+DEFINE_CLASS_0(bench_tiny1, bench_tiny1_class, bench_tiny1_methods,
+    sizeof(struct bench_tiny));
+DEFINE_CLASS_0(bench_tiny2, bench_tiny2_class, bench_tiny0_methods,
+    sizeof(struct bench_tiny));
+DEFINE_CLASS_0(bench_tiny3, bench_tiny3_class, bench_tiny1_methods,
+    sizeof(struct bench_tiny));
+
+static cobj_class_t bench_tiny_classes[BENCH_COMPACT_CLASSES] = {
+	&bench_tiny0_class,
+	&bench_tiny1_class,
+	&bench_tiny2_class,
+	&bench_tiny3_class
+};
+
+struct bench_compact {
+	cobj_arena_t	bc_arena;
+	cobj_t		*bc_objs;
+};
+
+static void
+bench_compact_walk(void *arg, int thr, u_long iters)
+{
+	struct bench_compact *bc = arg;
+	struct cobj_arena_cursor cur = { NULL, 0 };
+	cobj_t o;
+	int sum;
+
+	sum = 0;
+	while ((o = cobj_arena_next(bc->bc_arena, &cur)) != NULL)
+		sum += BENCH_STEP(o, 1);
+	bench_sink = sum;
+}
+
+static void
+bench_compact_array(void *arg, int thr, u_long iters)
+{
+	struct bench_compact *bc = arg;
+	u_long i;
+	int sum;
+
+	sum = 0;
+	for (i = 0; i < iters; i++)
+		sum += BENCH_STEP(bc->bc_objs[i], 1);
+	bench_sink = sum;
+}
+
+void
+bench_compact(u_long iters, int maxthreads)
+{
+	struct bench_compact bc;
+	size_t size;
+	u_long i;
+
+	size = iters * sizeof(struct bench_tiny);
+
+	if ((bc.bc_arena = cobj_arena_create(size)) == NULL ||
+	    (bc.bc_objs = calloc(iters, sizeof(cobj_t))) == NULL)
+		err(EX_OSERR, "calloc");
+
+	for (i = 0; i < iters; i++) {
+		bc.bc_objs[i] = cobj_create_in(bc.bc_arena,
+		    bench_tiny_classes[i % BENCH_COMPACT_CLASSES]);
+		if (bc.bc_objs[i] == NULL)
+			errx(EX_OSERR, "cobj_create_in failed");
+	}
+
+	(void)fprintf(stderr, "compact_%s: %zu byte header, %.2f bytes "
+	    "per object\n", BENCH_COMPACT_HDR, sizeof(struct cobj),
+	    (double)((char *)bc.bc_objs[iters - 1] - (char *)bc.bc_objs[0] +
+	    sizeof(struct bench_tiny)) / iters);
+
+	bench_report("compact_" BENCH_COMPACT_HDR "_walk", 1, iters,
+	    bench_threads(1, bench_compact_walk, &bc, iters));
+	bench_report("compact_" BENCH_COMPACT_HDR "_array", 1, iters,
+	    bench_threads(1, bench_compact_array, &bc, iters));
+
+	cobj_arena_destroy(bc.bc_arena);
+	free(bc.bc_objs);
+}
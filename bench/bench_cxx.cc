@@ -0,0 +1,77 @@
+/*-
+ * Copyright (c) 2019 Henning Matyschok
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+
+extern "C" {
+#include "bench.h"
+}
+
+/*
+ * Baseline for bench_dispatch.c, a C++ virtual call.
+ */
+
+class bench_shape {
+public:
+	virtual ~bench_shape() {}
+	virtual int step(int arg) = 0;
+};
+
+class bench_counter : public bench_shape {
+public:
+	bench_counter() : bc_state(0) {}
+	int step(int arg) { return (bc_state += arg); }
+private:
+	int	bc_state;
+};
+
+static bench_shape *
+bench_shape_create(void)
+{
+
+	return (new bench_counter());
+}
+
+/*
+ * Keep the compiler from seeing the dynamic type.
+ */
+static bench_shape *(*volatile bench_shape_factory)(void) =
+    bench_shape_create;
+
+extern "C" void
+bench_cxx_virtual(void *arg, int thr, u_long iters)
+{
+	bench_shape *bs;
+	int sum;
+
+	bs = (*bench_shape_factory)();
+
+	for (sum = 0; iters > 0; iters--)
+		sum += bs->step(1);
+
+	bench_sink = sum;
+	delete bs;
+}
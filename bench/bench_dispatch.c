@@ -0,0 +1,357 @@
+/*-
+ * Copyright (c) 2019 Henning Matyschok
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <stdlib.h>
+#include <sysexits.h>
+
+#include <libcobj.h>
+
+#include "bench.h"
+#include "bench_if.h"
+
+/*
+ * Method dispatch: cache hits, forced misses on a flat and on a
+ * deep multiple-inheritance hierarchy, static methods and class
+ * compile/free cycles, against a direct call, a table of function
+ * pointers and a C++ virtual call.
+ */
+
+#define BENCH_DEPTH	8
+
+/*
+ * IDs sharing their low bits, so that miss_a and miss_b
+ * evict each other from any ordinary ops table.  The top
+ * bit marks them static, as makeobjops.awk -s does, so
+ * that cobj_ops_release never frees them into the pool
+ * of run-time IDs.
+ */
+#define BENCH_MISS_A_ID	(0x80000000U | 0x40000000U)
+#define BENCH_MISS_B_ID	(0x80000000U | 0x40001000U)
+
+struct bench_dobj {
+	COBJ_FIELDS;
+	int	bd_state;
+};
+
+static int
+bench_dispatch_step(cobj_t o, int arg)
+{
+
+	return (((struct bench_dobj *)o)->bd_state += arg);
+}
+
+static int
+bench_dispatch_miss_a(cobj_t o)
+{
+
+	return (++((struct bench_dobj *)o)->bd_state);
+}
+
+static int
+bench_dispatch_miss_b(cobj_t o)
+{
+
+	return (--((struct bench_dobj *)o)->bd_state);
+}
+
+static int
+bench_dispatch_info(cobj_class_t c)
+{
+
+	return ((int)c->size);
+}
+
+static cobj_method_t bench_hit_methods[] = {
+	COBJ_METHOD(bench_step, bench_dispatch_step),
+	COBJ_METHOD(bench_miss_a, bench_dispatch_miss_a),
+	COBJ_METHOD(bench_miss_b, bench_dispatch_miss_b),
+	COBJ_METHOD(bench_info, bench_dispatch_info),
+	COBJ_METHOD_END
+};
+
+static cobj_method_t bench_root_methods[] = {
+	COBJ_METHOD(bench_miss_a, bench_dispatch_miss_a),
+	COBJ_METHOD(bench_miss_b, bench_dispatch_miss_b),
+	COBJ_METHOD_END
+};
+
+static cobj_method_t bench_empty_methods[] = {
+	COBJ_METHOD_END
+};
+
+DEFINE_CLASS_0(bench_hit, bench_hit_class, bench_hit_methods,
+    sizeof(struct bench_dobj));
+DEFINE_CLASS_0(bench_cycle, bench_cycle_class, bench_hit_methods,
+    sizeof(struct bench_dobj));
+
+/*
+ * Each level of the hierarchy derives from the one above
+ * and from a mixin, the methods are only implemented by
+ * the root, which comes right after the chain in the
+ * resolution order.
+ */
+DEFINE_CLASS_0(bench_deep0, bench_deep0_class, bench_root_methods,
+    sizeof(struct bench_dobj));
+DEFINE_CLASS_0(bench_mix, bench_mix_class, bench_empty_methods,
+    sizeof(struct bench_dobj));
+DEFINE_CLASS_2(bench_deep1, bench_deep1_class, bench_empty_methods,
+    sizeof(struct bench_dobj), bench_deep0_class, bench_mix_class);
+DEFINE_CLASS_2(bench_deep2, bench_deep2_class, bench_empty_methods,
+    sizeof(struct bench_dobj), bench_deep1_class, bench_mix_class);
+DEFINE_CLASS_2(bench_deep3, bench_deep3_class, bench_empty_methods,
+    sizeof(struct bench_dobj), bench_deep2_class, bench_mix_class);
+DEFINE_CLASS_2(bench_deep4, bench_deep4_class, bench_empty_methods,
+    sizeof(struct bench_dobj), bench_deep3_class, bench_mix_class);
+DEFINE_CLASS_2(bench_deep5, bench_deep5_class, bench_empty_methods,
+    sizeof(struct bench_dobj), bench_deep4_class, bench_mix_class);
+DEFINE_CLASS_2(bench_deep6, bench_deep6_class, bench_empty_methods,
+    sizeof(struct bench_dobj), bench_deep5_class, bench_mix_class);
+DEFINE_CLASS_2(bench_deep7, bench_deep7_class, bench_empty_methods,
+    sizeof(struct bench_dobj), bench_deep6_class, bench_mix_class);
+DEFINE_CLASS_2(bench_deep8, bench_deep8_class, bench_empty_methods,
+    sizeof(struct bench_dobj), bench_deep7_class, bench_mix_class);
+
+/*
+ * The same leaf, compiled into static space without the
+ * sorted method index, so that a miss walks the hierarchy.
+ */
+DEFINE_CLASS_2(bench_walk8, bench_walk8_class, bench_empty_methods,
+    sizeof(struct bench_dobj), bench_deep7_class, bench_mix_class);
+
+static COBJ_OPS_STATIC(bench_walk8_ops, COBJ_CACHE_MIN);
+
+/*
+ * Baseline, a direct call.
+ */
+static int __attribute__((__noinline__))
+bench_direct_step(struct bench_dobj *bd, int arg)
+{
+
+	/*
+	 * Keep the call from being optimized away.
+	 */
+	__asm__ __volatile__("" : : : "memory");
+
+	return (bd->bd_state += arg);
+}
+
+/*
+ * Baseline, a table of function pointers.
+ */
+struct bench_vtobj;
+
+struct bench_vtable {
+	int	(*vt_step)(struct bench_vtobj *, int);
+};
+
+struct bench_vtobj {
+	const struct bench_vtable	*vo_vt;
+	int				vo_state;
+};
+
+static int
+bench_vt_step(struct bench_vtobj *vo, int arg)
+{
+
+	return (vo->vo_state += arg);
+}
+
+static const struct bench_vtable bench_vt = {
+	bench_vt_step,
+};
+
+/*
+ * Keep the compiler from seeing the target.
+ */
+static const struct bench_vtable *volatile bench_vtp = &bench_vt;
+
+static void
+bench_dispatch_direct(void *arg, int thr, u_long iters)
+{
+	struct bench_dobj bd;
+	int sum;
+
+	bd.bd_state = 0;
+
+	for (sum = 0; iters > 0; iters--)
+		sum += bench_direct_step(&bd, 1);
+
+	bench_sink = sum;
+}
+
+static void
+bench_dispatch_vtable(void *arg, int thr, u_long iters)
+{
+	struct bench_vtobj vo;
+	int sum;
+
+	vo.vo_vt = bench_vtp;
+	vo.vo_state = 0;
+
+	for (sum = 0; iters > 0; iters--)
+		sum += (*vo.vo_vt->vt_step)(&vo, 1);
+
+	bench_sink = sum;
+}
+
+/*
+ * Every thread works on an instance of its own.
+ */
+static void
+bench_dispatch_hit(void *arg, int thr, u_long iters)
+{
+	cobj_t o;
+	int sum;
+
+	if ((o = cobj_create(arg)) == NULL)
+		errx(EX_OSERR, "cobj_create failed");
+
+	for (sum = 0; iters > 0; iters--)
+		sum += BENCH_STEP(o, 1);
+
+	bench_sink = sum;
+	(void)cobj_delete(o);
+}
+
+static void
+bench_dispatch_miss(void *arg, int thr, u_long iters)
+{
+	cobj_t o;
+	int sum;
+
+	if ((o = cobj_create(arg)) == NULL)
+		errx(EX_OSERR, "cobj_create failed");
+
+	for (sum = 0; iters > 1; iters -= 2) {
+		sum += BENCH_MISS_A(o);
+		sum += BENCH_MISS_B(o);
+	}
+
+	bench_sink = sum;
+	(void)cobj_delete(o);
+}
+
+static void
+bench_dispatch_static(void *arg, int thr, u_long iters)
+{
+	int sum;
+
+	for (sum = 0; iters > 0; iters--)
+		sum += BENCH_INFO(arg);
+
+	bench_sink = sum;
+}
+
+/*
+ * Compile and free a class without instances, the
+ * table is retired and either taken back or rebuilt
+ * depending on the grace period.
+ */
+static void
+bench_dispatch_cycle(void *arg, int thr, u_long iters)
+{
+	cobj_class_t c;
+
+	c = arg;
+
+	while (iters-- > 0) {
+		if (cobj_class_compile(c) != 0)
+			errx(EX_OSERR, "cobj_class_compile failed");
+		(void)cobj_class_free(c);
+	}
+}
+
+void
+bench_dispatch(u_long iters, int maxthreads)
+{
+	cobj_t pin[3];
+	u_int grace;
+	int n;
+
+	bench_miss_a_desc.id = BENCH_MISS_A_ID;
+	bench_miss_b_desc.id = BENCH_MISS_B_ID;
+
+	if (cobj_class_compile_static(&bench_walk8_class, &bench_walk8_ops.ops,
+	    sizeof(bench_walk8_ops)) != 0)
+		errx(EX_SOFTWARE, "cobj_class_compile_static failed");
+
+	if ((pin[0] = cobj_create(&bench_hit_class)) == NULL ||
+	    (pin[1] = cobj_create(&bench_deep8_class)) == NULL ||
+	    (pin[2] = cobj_create(&bench_walk8_class)) == NULL)
+		errx(EX_OSERR, "cobj_create failed");
+
+	iters &= ~1UL;
+
+	for (n = 1;; n *= 2) {
+		if (n > maxthreads)
+			n = maxthreads;
+
+		bench_report("call_direct", n, iters * n,
+		    bench_threads(n, bench_dispatch_direct, NULL, iters));
+		bench_report("call_vtable", n, iters * n,
+		    bench_threads(n, bench_dispatch_vtable, NULL, iters));
+		bench_report("call_cxx_virtual", n, iters * n,
+		    bench_threads(n, bench_cxx_virtual, NULL, iters));
+		bench_report("dispatch_hit", n, iters * n,
+		    bench_threads(n, bench_dispatch_hit, &bench_hit_class,
+		    iters));
+		bench_report("dispatch_static", n, iters * n,
+		    bench_threads(n, bench_dispatch_static, &bench_hit_class,
+		    iters));
+		bench_report("dispatch_miss", n, iters * n,
+		    bench_threads(n, bench_dispatch_miss, &bench_hit_class,
+		    iters));
+		bench_report("dispatch_miss_deep", n, iters * n,
+		    bench_threads(n, bench_dispatch_miss, &bench_deep8_class,
+		    iters));
+		bench_report("dispatch_miss_deep_walk", n, iters * n,
+		    bench_threads(n, bench_dispatch_miss, &bench_walk8_class,
+		    iters));
+
+		if (n == maxthreads)
+			break;
+	}
+
+	(void)cobj_delete(pin[0]);
+	(void)cobj_delete(pin[1]);
+	(void)cobj_delete(pin[2]);
+
+	/*
+	 * The ops table of a class belongs to the class,
+	 * so there is no point in running these on more
+	 * than one thread.
+	 */
+	bench_report("compile_free_reuse", 1, iters,
+	    bench_threads(1, bench_dispatch_cycle, &bench_cycle_class, iters));
+
+	grace = cobj_set_grace(0);
+	bench_report("compile_free_rebuild", 1, iters,
+	    bench_threads(1, bench_dispatch_cycle, &bench_cycle_class, iters));
+	(void)cobj_set_grace(grace);
+}
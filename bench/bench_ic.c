@@ -0,0 +1,217 @@
+/*-
+ * Copyright (c) 2019 Henning Matyschok
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <stdlib.h>
+#include <sysexits.h>
+
+#include <libcobj.h>
+
+#include "bench.h"
+#include "bench_if.h"
+
+/*
+ * One call site fed objects of one, two and more classes
+ * than an inline cache holds, through the wrapper sharing
+ * the cache of the class and through the wrapper caching
+ * at the call site.
+ */
+
+#define BENCH_IC_NOBJS	1024
+#define BENCH_IC_NKINDS	8
+
+struct bench_icobj {
+	COBJ_FIELDS;
+	int	bi_state;
+};
+
+static int
+bench_ic_add(cobj_t o, int arg)
+{
+	struct bench_icobj *bi = (struct bench_icobj *)o;
+
+	return (bi->bi_state += arg);
+}
+
+static int
+bench_ic_xor(cobj_t o, int arg)
+{
+	struct bench_icobj *bi = (struct bench_icobj *)o;
+
+	return (bi->bi_state ^= arg);
+}
+
+static cobj_method_t bench_ic_add_methods[] = {
+	COBJ_METHOD(bench_step, bench_ic_add),
+	COBJ_METHOD_END
+};
+
+static cobj_method_t bench_ic_xor_methods[] = {
+	COBJ_METHOD(bench_step, bench_ic_xor),
+	COBJ_METHOD_END
+};
+
+/*
+ * Classes only differ by name, every one has an ops
+ * table and so an inline cache entry of its own.
+ */
+DEFINE_CLASS_0(bench_ic0, bench_ic0_class, bench_ic_add_methods,
+    sizeof(struct bench_icobj));
+DEFINE_CLASS_0(bench_ic1, bench_ic1_class, bench_ic_xor_methods,
+    sizeof(struct bench_icobj));
+DEFINE_CLASS_0(bench_ic2, bench_ic2_class, bench_ic_add_methods,
+    sizeof(struct bench_icobj));
+DEFINE_CLASS_0(bench_ic3, bench_ic3_class, bench_ic_xor_methods,
+    sizeof(struct bench_icobj));
+DEFINE_CLASS_0(bench_ic4, bench_ic4_class, bench_ic_add_methods,
+    sizeof(struct bench_icobj));
+DEFINE_CLASS_0(bench_ic5, bench_ic5_class, bench_ic_xor_methods,
+    sizeof(struct bench_icobj));
+DEFINE_CLASS_0(bench_ic6, bench_ic6_class, bench_ic_add_methods,
+    sizeof(struct bench_icobj));
+DEFINE_CLASS_0(bench_ic7, bench_ic7_class, bench_ic_xor_methods,
+    sizeof(struct bench_icobj));
+
+static cobj_class_t bench_ic_kinds[BENCH_IC_NKINDS] = {
+	&bench_ic0_class, &bench_ic1_class,
+	&bench_ic2_class, &bench_ic3_class,
+	&bench_ic4_class, &bench_ic5_class,
+	&bench_ic6_class, &bench_ic7_class,
+};
+
+/*
+ * Per thread arrays of objects, drawn from the first
+ * 1, 2 and BENCH_IC_NKINDS classes.
+ */
+struct bench_ic_set {
+	cobj_t	**bs_objs;
+	int	bs_nkinds;
+	const char	*bs_shared;
+	const char	*bs_ic;
+};
+
+static struct bench_ic_set bench_ic_sets[] = {
+	{ NULL, 1, "dispatch_shared_mono", "dispatch_ic_mono" },
+	{ NULL, 2, "dispatch_shared_bi", "dispatch_ic_bi" },
+	{ NULL, BENCH_IC_NKINDS, "dispatch_shared_mega", "dispatch_ic_mega" },
+};
+
+#define BENCH_IC_NSETS	(sizeof(bench_ic_sets) / sizeof(bench_ic_sets[0]))
+
+static void
+bench_ic_shared(void *arg, int thr, u_long iters)
+{
+	cobj_t *objs;
+	u_long i;
+	int j;
+
+	objs = ((cobj_t **)arg)[thr];
+
+	for (i = 0; i < iters; i += BENCH_IC_NOBJS) {
+		for (j = 0; j < BENCH_IC_NOBJS; j++)
+			(void)BENCH_STEP(objs[j], 1);
+	}
+}
+
+static void
+bench_ic_site(void *arg, int thr, u_long iters)
+{
+	cobj_t *objs;
+	u_long i;
+	int j;
+
+	objs = ((cobj_t **)arg)[thr];
+
+	for (i = 0; i < iters; i += BENCH_IC_NOBJS) {
+		for (j = 0; j < BENCH_IC_NOBJS; j++)
+			(void)BENCH_STEP_IC(objs[j], 1);
+	}
+}
+
+void
+bench_ic(u_long iters, int maxthreads)
+{
+	struct bench_ic_set *bs;
+	u_int seed;
+	size_t s;
+	int i, j, n;
+
+	seed = 1;
+	for (s = 0; s < BENCH_IC_NSETS; s++) {
+		bs = &bench_ic_sets[s];
+
+		if ((bs->bs_objs = calloc(maxthreads, sizeof(cobj_t *))) == NULL)
+			err(EX_OSERR, "calloc");
+
+		for (i = 0; i < maxthreads; i++) {
+			bs->bs_objs[i] = calloc(BENCH_IC_NOBJS, sizeof(cobj_t));
+			if (bs->bs_objs[i] == NULL)
+				err(EX_OSERR, "calloc");
+
+			for (j = 0; j < BENCH_IC_NOBJS; j++) {
+				bs->bs_objs[i][j] = cobj_create(
+				    bench_ic_kinds[rand_r(&seed) % bs->bs_nkinds]);
+				if (bs->bs_objs[i][j] == NULL)
+					errx(EX_OSERR, "cobj_create failed");
+			}
+		}
+	}
+
+	iters = (iters + BENCH_IC_NOBJS - 1) / BENCH_IC_NOBJS * BENCH_IC_NOBJS;
+
+	for (n = 1;; n *= 2) {
+		if (n > maxthreads)
+			n = maxthreads;
+
+		for (s = 0; s < BENCH_IC_NSETS; s++) {
+			bs = &bench_ic_sets[s];
+
+			bench_report(bs->bs_shared, n, iters * n,
+			    bench_threads(n, bench_ic_shared, bs->bs_objs,
+			    iters));
+			bench_report(bs->bs_ic, n, iters * n,
+			    bench_threads(n, bench_ic_site, bs->bs_objs,
+			    iters));
+		}
+
+		if (n == maxthreads)
+			break;
+	}
+
+	for (s = 0; s < BENCH_IC_NSETS; s++) {
+		bs = &bench_ic_sets[s];
+
+		for (i = 0; i < maxthreads; i++) {
+			for (j = 0; j < BENCH_IC_NOBJS; j++)
+				(void)cobj_delete(bs->bs_objs[i][j]);
+			free(bs->bs_objs[i]);
+		}
+		free(bs->bs_objs);
+		bs->bs_objs = NULL;
+	}
+}
@@ -0,0 +1,71 @@
+# Copyright 2019 Henning Matyschok.
+# All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions
+# are met:
+# 1. Redistributions of source code must retain the above copyright
+#    notice, this list of conditions and the following disclaimer.
+# 2. Redistributions in binary form must reproduce the above copyright
+#    notice, this list of conditions and the following disclaimer in the
+#    documentation and/or other materials provided with the distribution.
+#
+# THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+# ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+# FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+# DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+# OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+# HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+# LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+# OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+# SUCH DAMAGE.
+
+#
+# Interface of the objects dispatched to by cobj_bench(1).
+#
+
+INTERFACE bench;
+
+#
+# Advance the object by arg, returns its new state.
+#
+#  ret = BENCH_STEP(object, arg);
+#
+METHOD int step {
+	cobj_t o;
+	int arg;
+};
+
+#
+# Methods which are made to share a cache slot, see
+# bench_dispatch.c.
+#
+METHOD int miss_a {
+	cobj_t o;
+};
+
+METHOD int miss_b {
+	cobj_t o;
+};
+
+#
+# Move a particle by dt, see bench_vector.c. Classes may implement
+# bench_move_vector to move an array of their particles at once.
+#
+#  BENCH_MOVE_VECTOR(objects, n, dt);
+#
+VECTORMETHOD void move {
+	cobj_t o;
+	float dt;
+};
+
+#
+# A static method, called on the class.
+#
+#  ret = BENCH_INFO(class);
+#
+STATICMETHOD int info {
+	cobj_class_t c;
+};
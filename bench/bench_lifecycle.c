@@ -0,0 +1,192 @@
+/*-
+ * Copyright (c) 2019 Henning Matyschok
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sysexits.h>
+
+#include <libcobj.h>
+
+#include "bench.h"
+
+/*
+ * Object create/delete throughput, scaling from one
+ * thread up to the number of CPUs.
+ */
+
+#define BENCH_NCLASSES	8
+
+static cobj_method_t bench_methods[] = {
+	COBJ_METHOD_END
+};
+
+DEFINE_CLASS_0(bench0, bench0_class, bench_methods, sizeof(struct cobj));
+DEFINE_CLASS_0(bench1, bench1_class, bench_methods, sizeof(struct cobj));
+DEFINE_CLASS_0(bench2, bench2_class, bench_methods, sizeof(struct cobj));
+DEFINE_CLASS_0(bench3, bench3_class, bench_methods, sizeof(struct cobj));
+DEFINE_CLASS_0(bench4, bench4_class, bench_methods, sizeof(struct cobj));
+DEFINE_CLASS_0(bench5, bench5_class, bench_methods, sizeof(struct cobj));
+DEFINE_CLASS_0(bench6, bench6_class, bench_methods, sizeof(struct cobj));
+DEFINE_CLASS_0(bench7, bench7_class, bench_methods, sizeof(struct cobj));
+
+static cobj_class_t bench_classes[BENCH_NCLASSES] = {
+	&bench0_class, &bench1_class, &bench2_class, &bench3_class,
+	&bench4_class, &bench5_class, &bench6_class, &bench7_class,
+};
+
+DEFINE_CLASS_0(bench_cross, bench_cross_class, bench_methods,
+    sizeof(struct cobj));
+
+static void *
+bench_delete_thread(void *arg)
+{
+
+	(void)cobj_delete(arg);
+	return (NULL);
+}
+
+/*
+ * The last instance has to be noticed when its reference is
+ * dropped from the shard of a thread which still counts one,
+ * while another thread's shard is below zero: one thread
+ * creates two objects, another deletes the first, and the
+ * delete of the second must retire the table of the class.
+ */
+static void
+bench_lifecycle_check(void)
+{
+	pthread_t td;
+	cobj_t a, b;
+
+	if ((a = cobj_create(&bench_cross_class)) == NULL ||
+	    (b = cobj_create(&bench_cross_class)) == NULL)
+		errx(EX_OSERR, "cobj_create failed");
+
+	if (pthread_create(&td, NULL, bench_delete_thread, a) != 0 ||
+	    pthread_join(td, NULL) != 0)
+		errx(EX_OSERR, "pthread_create failed");
+
+	if (bench_cross_class.ops == NULL)
+		errx(EX_SOFTWARE, "table retired with an instance left");
+
+	(void)cobj_delete(b);
+
+	if (bench_cross_class.ops != NULL)
+		errx(EX_SOFTWARE, "table not retired after a cross-thread "
+		    "delete");
+}
+
+/*
+ * Every thread churns instances of the same class.
+ */
+static void
+bench_create_delete_shared(void *arg, int thr, u_long iters)
+{
+	cobj_t o;
+
+	while (iters-- > 0) {
+		if ((o = cobj_create(bench_classes[0])) == NULL)
+			errx(EX_OSERR, "cobj_create failed");
+		(void)cobj_delete(o);
+	}
+}
+
+/*
+ * Every thread churns instances of its own class.
+ */
+static void
+bench_create_delete_private(void *arg, int thr, u_long iters)
+{
+	cobj_class_t c;
+	cobj_t o;
+
+	c = bench_classes[thr % BENCH_NCLASSES];
+
+	while (iters-- > 0) {
+		if ((o = cobj_create(c)) == NULL)
+			errx(EX_OSERR, "cobj_create failed");
+		(void)cobj_delete(o);
+	}
+}
+
+void
+bench_lifecycle(u_long iters, int maxthreads)
+{
+	struct cobj_ops_stats st;
+	cobj_t pin[BENCH_NCLASSES];
+	int i, n;
+
+	bench_lifecycle_check();
+
+	/*
+	 * Keep one instance of each class alive, so that we measure
+	 * object churn and not the compile/free cycle of the class.
+	 */
+	for (i = 0; i < BENCH_NCLASSES; i++) {
+		if ((pin[i] = cobj_create(bench_classes[i])) == NULL)
+			errx(EX_OSERR, "cobj_create failed");
+	}
+
+	for (n = 1;; n *= 2) {
+		if (n > maxthreads)
+			n = maxthreads;
+
+		bench_report("create_delete_shared", n, iters * n,
+		    bench_threads(n, bench_create_delete_shared, NULL, iters));
+		bench_report("create_delete_private", n, iters * n,
+		    bench_threads(n, bench_create_delete_private, NULL, iters));
+
+		if (n == maxthreads)
+			break;
+	}
+
+	for (i = 0; i < BENCH_NCLASSES; i++)
+		(void)cobj_delete(pin[i]);
+
+	/*
+	 * Without the pinned instances every delete retires the
+	 * table of the class, and the next create takes it back.
+	 */
+	for (n = 1;; n *= 2) {
+		if (n > maxthreads)
+			n = maxthreads;
+
+		bench_report("create_delete_last", n, iters * n,
+		    bench_threads(n, bench_create_delete_private, NULL, iters));
+
+		if (n == maxthreads)
+			break;
+	}
+
+	cobj_ops_stats(&st);
+	(void)fprintf(stderr, "ops tables: %lu compiled, %lu reused, "
+	    "%lu retired, %lu freed\n", st.compiled, st.reused, st.retired,
+	    st.freed);
+}
@@ -0,0 +1,207 @@
+/*-
+ * Copyright (c) 2019 Henning Matyschok
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <sysexits.h>
+
+#include <libcobj.h>
+
+#include "bench.h"
+#include "tailq_if.h"
+
+/*
+ * Producer/consumer throughput through a queue shared by all
+ * threads: lfq_class(3), and tailq_class(3) behind a mutex,
+ * which it needs to be shared at all. Half of the threads
+ * produce, the other half consume; a single thread does both
+ * in turn. Items are moved one at a time, or BENCH_QUEUE_BULK
+ * at a time with TAILQ_ADD_BULK() and TAILQ_POLL_BULK().
+ */
+
+#define BENCH_QUEUE_BULK	32
+
+DECLARE_CLASS(tailq_class);
+DECLARE_CLASS(lfq_class);
+
+struct bench_queue {
+	cobj_t		bq_q;
+	pthread_mutex_t	*bq_lock;	/* NULL if lock-free */
+	int		bq_bulk;	/* items per call */
+};
+
+static pthread_mutex_t bench_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int bench_queue_item;
+
+/*
+ * Enqueue and dequeue up to n items, return how many.
+ */
+static int
+bench_queue_put(struct bench_queue *bq, void **items, int n)
+{
+	int rv;
+
+	if (bq->bq_lock != NULL)
+		pthread_mutex_lock(bq->bq_lock);
+	if (bq->bq_bulk > 1)
+		rv = TAILQ_ADD_BULK(bq->bq_q, items, n);
+	else
+		rv = (TAILQ_ADD(bq->bq_q, items[0]) == 0);
+	if (bq->bq_lock != NULL)
+		pthread_mutex_unlock(bq->bq_lock);
+
+	return (rv);
+}
+
+static int
+bench_queue_get(struct bench_queue *bq, void **items, int n)
+{
+	int rv;
+
+	if (bq->bq_lock != NULL)
+		pthread_mutex_lock(bq->bq_lock);
+	if (bq->bq_bulk > 1)
+		rv = TAILQ_POLL_BULK(bq->bq_q, items, n);
+	else
+		rv = ((items[0] = TAILQ_POLL(bq->bq_q)) != NULL);
+	if (bq->bq_lock != NULL)
+		pthread_mutex_unlock(bq->bq_lock);
+
+	return (rv);
+}
+
+static void
+bench_queue_solo(void *arg, int thr, u_long iters)
+{
+	void *items[BENCH_QUEUE_BULK];
+	struct bench_queue *bq;
+	int i, n;
+
+	bq = arg;
+
+	for (i = 0; i < BENCH_QUEUE_BULK; i++)
+		items[i] = &bench_queue_item;
+
+	while (iters > 0) {
+		n = (iters < (u_long)bq->bq_bulk) ? (int)iters : bq->bq_bulk;
+		if (bench_queue_put(bq, items, n) != n ||
+		    bench_queue_get(bq, items, n) != n)
+			errx(EX_SOFTWARE, "queue lost an item");
+		iters -= n;
+	}
+}
+
+/*
+ * Even threads produce iters items, odd ones consume as many.
+ */
+static void
+bench_queue_pc(void *arg, int thr, u_long iters)
+{
+	void *items[BENCH_QUEUE_BULK];
+	struct bench_queue *bq;
+	int i, n, k;
+
+	bq = arg;
+
+	for (i = 0; i < BENCH_QUEUE_BULK; i++)
+		items[i] = &bench_queue_item;
+
+	while (iters > 0) {
+		n = (iters < (u_long)bq->bq_bulk) ? (int)iters : bq->bq_bulk;
+		if (thr % 2 == 0)
+			k = bench_queue_put(bq, items, n);
+		else
+			k = bench_queue_get(bq, items, n);
+		if (k > 0)
+			iters -= k;
+		else
+			sched_yield();
+	}
+}
+
+static void
+bench_queue_run(const char *name, cobj_class_t c, pthread_mutex_t *lock,
+    int bulk, u_long iters, int n)
+{
+	struct bench_queue bq;
+	double ns;
+
+	if ((bq.bq_q = TAILQ_CREATE(c)) == NULL)
+		errx(EX_OSERR, "TAILQ_CREATE failed");
+	bq.bq_lock = lock;
+	bq.bq_bulk = bulk;
+
+	if (n == 1)
+		ns = bench_threads(1, bench_queue_solo, &bq, iters);
+	else
+		ns = bench_threads(n, bench_queue_pc, &bq, iters);
+
+	bench_report(name, n, iters * (n == 1 ? 1 : n / 2), ns);
+
+	(void)TAILQ_DESTROY(c, bq.bq_q);
+}
+
+void
+bench_queue(u_long iters, int maxthreads)
+{
+	cobj_t pin[2];
+	int n;
+
+	/*
+	 * tailq_{create,destroy}(3) are static methods, keep
+	 * the classes compiled between the runs.
+	 */
+	if ((pin[0] = cobj_create(&tailq_class)) == NULL ||
+	    (pin[1] = cobj_create(&lfq_class)) == NULL)
+		errx(EX_OSERR, "cobj_create failed");
+
+	for (n = 1;; n *= 2) {
+		if (n > maxthreads)
+			n = maxthreads;
+		if (n > 1)
+			n &= ~1;
+
+		bench_queue_run("queue_tailq_mutex", &tailq_class,
+		    &bench_queue_lock, 1, iters, n);
+		bench_queue_run("queue_lfq", &lfq_class, NULL, 1, iters, n);
+		bench_queue_run("queue_tailq_mutex_bulk", &tailq_class,
+		    &bench_queue_lock, BENCH_QUEUE_BULK, iters, n);
+		bench_queue_run("queue_lfq_bulk", &lfq_class, NULL,
+		    BENCH_QUEUE_BULK, iters, n);
+
+		/* n is even past 1; stop at the largest even count. */
+		if (n >= (maxthreads & ~1))
+			break;
+	}
+
+	(void)cobj_delete(pin[0]);
+	(void)cobj_delete(pin[1]);
+}
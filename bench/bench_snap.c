@@ -0,0 +1,209 @@
+/*-
+ * Copyright (c) 2019 Henning Matyschok
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+#include <libcobj.h>
+
+#include "bench.h"
+#include "bench_if.h"
+#include "tailq_if.h"
+
+/*
+ * Restart from a snapshot against rebuilding the same objects:
+ * snap_rebuild creates every object and calls it once, snap_map
+ * maps a snapshot of them and calls each once, snap_open only
+ * maps and unmaps it. A queue saved along with them checks that
+ * tailq_class(3) relinks its items.
+ */
+
+#define BENCH_SNAP_ITEMS	100
+
+DECLARE_CLASS(tailq_class);
+
+struct bench_snapobj {
+	COBJ_FIELDS;
+	int	bs_state;
+};
+
+static int
+bench_snapobj_step(cobj_t o, int arg)
+{
+	struct bench_snapobj *bs = (struct bench_snapobj *)o;
+
+	return (bs->bs_state += arg);
+}
+
+static cobj_method_t bench_snapobj_methods[] = {
+	COBJ_METHOD(bench_step, bench_snapobj_step),
+	COBJ_METHOD_END
+};
+
+DEFINE_CLASS_0(bench_snapobj, bench_snapobj_class, bench_snapobj_methods,
+    sizeof(struct bench_snapobj));
+
+static cobj_class_t bench_snap_classes[] = {
+	&bench_snapobj_class,
+	&tailq_class,
+	NULL
+};
+
+static char bench_snap_path[] = "/tmp/cobj_bench.XXXXXX";
+
+static void
+bench_snap_rebuild(void *arg, int thr, u_long iters)
+{
+	cobj_t *objs;
+	u_long i;
+
+	objs = arg;
+
+	for (i = 0; i < iters; i++) {
+		if ((objs[i] = cobj_create(&bench_snapobj_class)) == NULL)
+			errx(EX_OSERR, "cobj_create failed");
+		((struct bench_snapobj *)objs[i])->bs_state = (int)i;
+	}
+
+	for (i = 0; i < iters; i++)
+		bench_sink += BENCH_STEP(objs[i], 1);
+}
+
+static void
+bench_snap_map(void *arg, int thr, u_long iters)
+{
+	cobj_snap_map_t map;
+	u_long i;
+
+	if ((map = cobj_snap_open(bench_snap_path, bench_snap_classes)) == NULL)
+		errx(EX_SOFTWARE, "cobj_snap_open failed");
+
+	for (i = 0; i < iters; i++)
+		bench_sink += BENCH_STEP(cobj_snap_object(map, i), 1);
+
+	*(cobj_snap_map_t *)arg = map;
+}
+
+static void
+bench_snap_open(void *arg, int thr, u_long iters)
+{
+	cobj_snap_map_t map;
+
+	if ((map = cobj_snap_open(bench_snap_path, bench_snap_classes)) == NULL)
+		errx(EX_SOFTWARE, "cobj_snap_open failed");
+
+	cobj_snap_close(map);
+}
+
+/*
+ * Save iters objects and a queue, and check the queue comes back.
+ */
+static void
+bench_snap_write(u_long iters)
+{
+	cobj_snap_map_t map;
+	cobj_snap_t snap;
+	cobj_t o, q;
+	u_long i;
+	int fd;
+
+	if ((fd = mkstemp(bench_snap_path)) < 0)
+		err(EX_CANTCREAT, "mkstemp");
+	(void)close(fd);
+
+	if ((snap = cobj_snap_create()) == NULL)
+		errx(EX_OSERR, "cobj_snap_create failed");
+
+	for (i = 0; i < iters; i++) {
+		if ((o = cobj_create(&bench_snapobj_class)) == NULL)
+			errx(EX_OSERR, "cobj_create failed");
+		((struct bench_snapobj *)o)->bs_state = (int)i;
+		if (cobj_snap_add(snap, o) == 0)
+			errx(EX_OSERR, "cobj_snap_add failed");
+		(void)cobj_delete(o);
+	}
+
+	/* TAILQ_CREATE() is a static method, see main.c. */
+	(void)cobj_class_compile(&tailq_class);
+	if ((q = TAILQ_CREATE(&tailq_class)) == NULL)
+		errx(EX_OSERR, "TAILQ_CREATE failed");
+	for (i = 1; i <= BENCH_SNAP_ITEMS; i++)
+		(void)TAILQ_ADD(q, (void *)i);
+	if (cobj_snap_add(snap, q) == 0 ||
+	    cobj_snap_write(snap, bench_snap_path) != 0)
+		err(EX_IOERR, "%s", bench_snap_path);
+	(void)TAILQ_DESTROY(&tailq_class, q);
+	cobj_snap_destroy(snap);
+
+	if ((map = cobj_snap_open(bench_snap_path, bench_snap_classes)) == NULL)
+		errx(EX_SOFTWARE, "cobj_snap_open failed");
+	q = cobj_snap_object(map, iters);
+	for (i = 1; i <= BENCH_SNAP_ITEMS; i++) {
+		if (TAILQ_POLL(q) != (void *)i)
+			errx(EX_SOFTWARE, "queue not restored");
+	}
+	if (TAILQ_POLL(q) != NULL || TAILQ_ADD(q, (void *)1) != 0 ||
+	    TAILQ_POLL(q) != (void *)1)
+		errx(EX_SOFTWARE, "queue not restored");
+	(void)TAILQ_FLUSH(q);
+	cobj_snap_close(map);
+}
+
+void
+bench_snap(u_long iters, int maxthreads)
+{
+	cobj_snap_map_t map;
+	cobj_t *objs;
+	u_long i;
+
+	bench_snap_write(iters);
+
+	if ((objs = calloc(iters, sizeof(cobj_t))) == NULL)
+		err(EX_OSERR, "calloc");
+
+	bench_report("snap_rebuild", 1, iters,
+	    bench_threads(1, bench_snap_rebuild, objs, iters));
+	bench_report("snap_open", 1, iters,
+	    bench_threads(1, bench_snap_open, NULL, iters));
+	bench_report("snap_map", 1, iters,
+	    bench_threads(1, bench_snap_map, &map, iters));
+
+	for (i = 0; i < iters; i++) {
+		if (BENCH_STEP(cobj_snap_object(map, i), 0) !=
+		    BENCH_STEP(objs[i], 0))
+			errx(EX_SOFTWARE, "snapshot differs");
+		(void)cobj_delete(objs[i]);
+	}
+
+	cobj_snap_close(map);
+	free(objs);
+	(void)unlink(bench_snap_path);
+}
@@ -0,0 +1,193 @@
+/*-
+ * Copyright (c) 2019 Henning Matyschok
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <stdlib.h>
+#include <sysexits.h>
+
+#include <libcobj.h>
+
+#include "bench.h"
+#include "bench_if.h"
+
+/*
+ * A stack of decorator classes, each adding to the result of the
+ * class it derives from, calling the overridden method through
+ * BENCH_STEP_SUPER() against the same stack with every layer
+ * calling the function below it by name.
+ */
+
+struct bench_sobj {
+	COBJ_FIELDS;
+	int	bs_state;
+};
+
+DECLARE_CLASS(bench_layer1_class);
+DECLARE_CLASS(bench_layer2_class);
+DECLARE_CLASS(bench_layer3_class);
+
+static int
+bench_layer0_step(cobj_t o, int arg)
+{
+	struct bench_sobj *bs = (struct bench_sobj *)o;
+
+	return (bs->bs_state += arg);
+}
+
+static int
+bench_layer1_step(cobj_t o, int arg)
+{
+
+	return (BENCH_STEP_SUPER(&bench_layer1_class, o, arg) + 1);
+}
+
+static int
+bench_layer2_step(cobj_t o, int arg)
+{
+
+	return (BENCH_STEP_SUPER(&bench_layer2_class, o, arg) + 1);
+}
+
+static int
+bench_layer3_step(cobj_t o, int arg)
+{
+
+	return (BENCH_STEP_SUPER(&bench_layer3_class, o, arg) + 1);
+}
+
+static cobj_method_t bench_layer0_methods[] = {
+	COBJ_METHOD(bench_step, bench_layer0_step),
+	COBJ_METHOD_END
+};
+
+static cobj_method_t bench_layer1_methods[] = {
+	COBJ_METHOD(bench_step, bench_layer1_step),
+	COBJ_METHOD_END
+};
+
+static cobj_method_t bench_layer2_methods[] = {
+	COBJ_METHOD(bench_step, bench_layer2_step),
+	COBJ_METHOD_END
+};
+
+static cobj_method_t bench_layer3_methods[] = {
+	COBJ_METHOD(bench_step, bench_layer3_step),
+	COBJ_METHOD_END
+};
+
+DEFINE_CLASS_0(bench_layer0, bench_layer0_class, bench_layer0_methods,
+    sizeof(struct bench_sobj));
+DEFINE_CLASS_1(bench_layer1, bench_layer1_class, bench_layer1_methods,
+    sizeof(struct bench_sobj), bench_layer0_class);
+DEFINE_CLASS_1(bench_layer2, bench_layer2_class, bench_layer2_methods,
+    sizeof(struct bench_sobj), bench_layer1_class);
+DEFINE_CLASS_1(bench_layer3, bench_layer3_class, bench_layer3_methods,
+    sizeof(struct bench_sobj), bench_layer2_class);
+
+/*
+ * The same layers, hard-wired.
+ */
+static __attribute__((__noinline__)) int
+bench_direct1_step(cobj_t o, int arg)
+{
+
+	return (bench_layer0_step(o, arg) + 1);
+}
+
+static __attribute__((__noinline__)) int
+bench_direct2_step(cobj_t o, int arg)
+{
+
+	return (bench_direct1_step(o, arg) + 1);
+}
+
+static __attribute__((__noinline__)) int
+bench_direct3_step(cobj_t o, int arg)
+{
+
+	return (bench_direct2_step(o, arg) + 1);
+}
+
+static cobj_method_t bench_direct3_methods[] = {
+	COBJ_METHOD(bench_step, bench_direct3_step),
+	COBJ_METHOD_END
+};
+
+DEFINE_CLASS_0(bench_direct3, bench_direct3_class, bench_direct3_methods,
+    sizeof(struct bench_sobj));
+
+static void
+bench_super_chain(void *arg, int thr, u_long iters)
+{
+	cobj_t o;
+
+	o = ((cobj_t *)arg)[thr];
+
+	while (iters-- > 0)
+		(void)BENCH_STEP(o, 1);
+}
+
+void
+bench_super(u_long iters, int maxthreads)
+{
+	cobj_t *layered, *direct;
+	int i, n;
+
+	if ((layered = calloc(maxthreads, sizeof(cobj_t))) == NULL ||
+	    (direct = calloc(maxthreads, sizeof(cobj_t))) == NULL)
+		err(EX_OSERR, "calloc");
+
+	for (i = 0; i < maxthreads; i++) {
+		if ((layered[i] = cobj_create(&bench_layer3_class)) == NULL ||
+		    (direct[i] = cobj_create(&bench_direct3_class)) == NULL)
+			errx(EX_OSERR, "cobj_create failed");
+	}
+
+	if (BENCH_STEP(layered[0], 1) != 4 || BENCH_STEP(direct[0], 1) != 4)
+		errx(EX_SOFTWARE, "layers disagree");
+
+	for (n = 1;; n *= 2) {
+		if (n > maxthreads)
+			n = maxthreads;
+
+		bench_report("super_chain_cached", n, iters * n,
+		    bench_threads(n, bench_super_chain, layered, iters));
+		bench_report("super_chain_direct", n, iters * n,
+		    bench_threads(n, bench_super_chain, direct, iters));
+
+		if (n == maxthreads)
+			break;
+	}
+
+	for (i = 0; i < maxthreads; i++) {
+		(void)cobj_delete(layered[i]);
+		(void)cobj_delete(direct[i]);
+	}
+	free(layered);
+	free(direct);
+}
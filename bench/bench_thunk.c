@@ -0,0 +1,163 @@
+/*-
+ * Copyright (c) 2019 Henning Matyschok
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <stdlib.h>
+#include <sysexits.h>
+
+#include <libcobj.h>
+
+#include "bench.h"
+#include "bench_if.h"
+
+/*
+ * Method wrappers inlined at every call, the default, against the
+ * out-of-line ones generated with COBJ_THUNKS, see makeobjops.awk -o:
+ * calls on one object from a single call site, and from 64 call
+ * sites on objects of four classes, which is where the size of the
+ * inlined lookups shows. The records are named after the mode the
+ * benchmark was built with, which is what a run of the other build
+ * is compared with, along with the text size of both, see size(1).
+ */
+
+#ifdef COBJ_THUNKS
+#define BENCH_THUNK_MODE	"thunk"
+#else
+#define BENCH_THUNK_MODE	"inline"
+#endif
+
+#define BENCH_THUNK_NOBJS	16
+#define BENCH_THUNK_SITES	64
+
+struct bench_tobj {
+	COBJ_FIELDS;
+	int	bt_state;
+};
+
+static int
+bench_tobj_add(cobj_t o, int arg)
+{
+
+	return (((struct bench_tobj *)o)->bt_state += arg);
+}
+
+static int
+bench_tobj_xor(cobj_t o, int arg)
+{
+
+	return (((struct bench_tobj *)o)->bt_state ^= arg);
+}
+
+static cobj_method_t bench_tadd_methods[] = {
+	COBJ_METHOD(bench_step, bench_tobj_add),
+	COBJ_METHOD_END
+};
+
+static cobj_method_t bench_txor_methods[] = {
+	COBJ_METHOD(bench_step, bench_tobj_xor),
+	COBJ_METHOD_END
+};
+
+DEFINE_CLASS_0(bench_tadd, bench_tadd_class, bench_tadd_methods,
+    sizeof(struct bench_tobj));
+DEFINE_CLASS_0(bench_txor, bench_txor_class, bench_txor_methods,
+    sizeof(struct bench_tobj));
+DEFINE_CLASS_0(bench_tadd2, bench_tadd2_class, bench_tadd_methods,
+    sizeof(struct bench_tobj));
+DEFINE_CLASS_0(bench_txor2, bench_txor2_class, bench_txor_methods,
+    sizeof(struct bench_tobj));
+
+static cobj_class_t bench_thunk_classes[] = {
+	&bench_tadd_class, &bench_txor_class,
+	&bench_tadd2_class, &bench_txor2_class,
+};
+
+static void
+bench_thunk_mono(void *arg, int thr, u_long iters)
+{
+	cobj_t o;
+	int sum;
+
+	o = ((cobj_t *)arg)[0];
+
+	sum = 0;
+	while (iters-- > 0)
+		sum += BENCH_STEP(o, 1);
+	bench_sink = sum;
+}
+
+#define BENCH_SITE(i)	\
+	sum += BENCH_STEP(objs[(i) % BENCH_THUNK_NOBJS], (i))
+#define BENCH_SITE4(i)	\
+	BENCH_SITE(i); BENCH_SITE(i + 1); BENCH_SITE(i + 2); BENCH_SITE(i + 3)
+#define BENCH_SITE16(i)	\
+	BENCH_SITE4(i); BENCH_SITE4(i + 4); BENCH_SITE4(i + 8); BENCH_SITE4(i + 12)
+
+static void
+bench_thunk_sites(void *arg, int thr, u_long iters)
+{
+	cobj_t *objs;
+	u_long i;
+	int sum;
+
+	objs = arg;
+
+	sum = 0;
+	for (i = 0; i < iters; i += BENCH_THUNK_SITES) {
+		BENCH_SITE16(0);
+		BENCH_SITE16(16);
+		BENCH_SITE16(32);
+		BENCH_SITE16(48);
+	}
+	bench_sink = sum;
+}
+
+void
+bench_thunk(u_long iters, int maxthreads)
+{
+	cobj_t objs[BENCH_THUNK_NOBJS];
+	int i;
+
+	for (i = 0; i < BENCH_THUNK_NOBJS; i++) {
+		if ((objs[i] = cobj_create(bench_thunk_classes[i %
+		    (sizeof(bench_thunk_classes) /
+		    sizeof(bench_thunk_classes[0]))])) == NULL)
+			errx(EX_OSERR, "cobj_create failed");
+	}
+
+	iters = (iters + BENCH_THUNK_SITES - 1) / BENCH_THUNK_SITES *
+	    BENCH_THUNK_SITES;
+
+	bench_report("wrapper_" BENCH_THUNK_MODE "_mono", 1, iters,
+	    bench_threads(1, bench_thunk_mono, objs, iters));
+	bench_report("wrapper_" BENCH_THUNK_MODE "_sites", 1, iters,
+	    bench_threads(1, bench_thunk_sites, objs, iters));
+
+	for (i = 0; i < BENCH_THUNK_NOBJS; i++)
+		(void)cobj_delete(objs[i]);
+}
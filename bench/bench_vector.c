@@ -0,0 +1,168 @@
+/*-
+ * Copyright (c) 2019 Henning Matyschok
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <stdlib.h>
+#include <sysexits.h>
+
+#include <libcobj.h>
+
+#include "bench.h"
+#include "bench_if.h"
+
+/*
+ * Particles kept in a vector, moved one wrapper call per particle
+ * and with one call of the vector wrapper, of a class which only
+ * implements the scalar method, getting the generated loop, and of
+ * one which also implements the vector method with a loop the
+ * compiler can vectorize.
+ */
+
+#define BENCH_VECTOR_N	1024
+
+struct bench_particle {
+	COBJ_FIELDS;
+	float	bp_pos;
+	float	bp_vel;
+};
+
+static void
+bench_particle_move(cobj_t o, float dt)
+{
+	struct bench_particle *bp = (struct bench_particle *)o;
+
+	bp->bp_pos += bp->bp_vel * dt;
+}
+
+static void
+bench_particle_move_vector(cobj_t objs, size_t n, float dt)
+{
+	struct bench_particle *bp = (struct bench_particle *)objs;
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		bp[i].bp_pos += bp[i].bp_vel * dt;
+}
+
+static cobj_method_t bench_pscalar_methods[] = {
+	COBJ_METHOD(bench_move, bench_particle_move),
+	COBJ_METHOD_END
+};
+
+static cobj_method_t bench_pvector_methods[] = {
+	COBJ_METHOD(bench_move, bench_particle_move),
+	COBJ_METHOD(bench_move_vector, bench_particle_move_vector),
+	COBJ_METHOD_END
+};
+
+DEFINE_CLASS_0(bench_pscalar, bench_pscalar_class, bench_pscalar_methods,
+    sizeof(struct bench_particle));
+DEFINE_CLASS_0(bench_pvector, bench_pvector_class, bench_pvector_methods,
+    sizeof(struct bench_particle));
+
+/*
+ * Call the wrapper on every particle, one at a time.
+ */
+static void
+bench_vector_single(void *arg, int thr, u_long iters)
+{
+	cobj_vec_t vec = arg;
+	u_long i;
+	size_t j;
+
+	for (i = 0; i < iters; i += BENCH_VECTOR_N) {
+		for (j = 0; j < vec->n; j++)
+			BENCH_MOVE(cobj_vec_at(vec, j), 0.5f);
+	}
+}
+
+/*
+ * Call the vector wrapper on all particles.
+ */
+static void
+bench_vector_vector(void *arg, int thr, u_long iters)
+{
+	cobj_vec_t vec = arg;
+	u_long i;
+
+	for (i = 0; i < iters; i += BENCH_VECTOR_N)
+		BENCH_MOVE_VEC(vec, 0.5f);
+}
+
+static cobj_vec_t
+bench_vector_create(cobj_class_t cls)
+{
+	struct bench_particle *bp;
+	cobj_vec_t vec;
+	size_t i;
+
+	if ((vec = cobj_vec_create(cls, BENCH_VECTOR_N)) == NULL)
+		errx(EX_OSERR, "cobj_vec_create failed");
+
+	for (i = 0; i < vec->n; i++) {
+		bp = (struct bench_particle *)cobj_vec_at(vec, i);
+		bp->bp_vel = (float)i;
+	}
+
+	return (vec);
+}
+
+void
+bench_vector(u_long iters, int maxthreads)
+{
+	cobj_vec_t scalar, vector;
+	size_t i;
+
+	scalar = bench_vector_create(&bench_pscalar_class);
+	vector = bench_vector_create(&bench_pvector_class);
+
+	/*
+	 * The kernel and the generated loop have to agree.
+	 */
+	BENCH_MOVE_VEC(scalar, 1.0f);
+	BENCH_MOVE_VEC(vector, 1.0f);
+	for (i = 0; i < BENCH_VECTOR_N; i++) {
+		if (((struct bench_particle *)cobj_vec_at(scalar, i))->bp_pos !=
+		    ((struct bench_particle *)cobj_vec_at(vector, i))->bp_pos ||
+		    ((struct bench_particle *)cobj_vec_at(vector, i))->bp_pos !=
+		    (float)i)
+			errx(EX_SOFTWARE, "vector kernel and loop disagree");
+	}
+
+	iters = (iters + BENCH_VECTOR_N - 1) / BENCH_VECTOR_N * BENCH_VECTOR_N;
+
+	bench_report("vector_single", 1, iters,
+	    bench_threads(1, bench_vector_single, vector, iters));
+	bench_report("vector_scalar_loop", 1, iters,
+	    bench_threads(1, bench_vector_vector, scalar, iters));
+	bench_report("vector_kernel", 1, iters,
+	    bench_threads(1, bench_vector_vector, vector, iters));
+
+	cobj_vec_destroy(scalar);
+	cobj_vec_destroy(vector);
+}
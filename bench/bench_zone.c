@@ -0,0 +1,145 @@
+/*-
+ * Copyright (c) 2019 Henning Matyschok
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <stdlib.h>
+#include <sysexits.h>
+
+#include <libcobj.h>
+
+#include "bench.h"
+
+/*
+ * Object create/delete throughput of a class backed by
+ * a zone, against one which uses calloc(3), and of request
+ * scoped objects taken from an arena.
+ */
+
+#define BENCH_BATCH	64
+
+struct bench_zobj {
+	COBJ_FIELDS;
+	char	bz_data[48];
+};
+
+static cobj_method_t bench_zone_methods[] = {
+	COBJ_METHOD_END
+};
+
+DEFINE_CLASS_0(bench_calloc, bench_calloc_class, bench_zone_methods,
+    sizeof(struct bench_zobj));
+DEFINE_CLASS_0(bench_zone, bench_zone_class, bench_zone_methods,
+    sizeof(struct bench_zobj));
+
+/*
+ * Create a batch of objects and delete them again.
+ */
+static void
+bench_zone_churn(void *arg, int thr, u_long iters)
+{
+	cobj_t objs[BENCH_BATCH];
+	cobj_class_t c;
+	u_long i;
+	int j;
+
+	c = arg;
+
+	for (i = 0; i < iters; i += BENCH_BATCH) {
+		for (j = 0; j < BENCH_BATCH; j++) {
+			if ((objs[j] = cobj_create(c)) == NULL)
+				errx(EX_OSERR, "cobj_create failed");
+		}
+		for (j = 0; j < BENCH_BATCH; j++)
+			(void)cobj_delete(objs[j]);
+	}
+}
+
+/*
+ * Create a batch of objects in a per-thread arena and
+ * release them with a reset.
+ */
+static void
+bench_zone_arena(void *arg, int thr, u_long iters)
+{
+	cobj_arena_t arena;
+	cobj_class_t c;
+	u_long i;
+	int j;
+
+	c = arg;
+
+	if ((arena = cobj_arena_create(0)) == NULL)
+		errx(EX_OSERR, "cobj_arena_create failed");
+
+	for (i = 0; i < iters; i += BENCH_BATCH) {
+		for (j = 0; j < BENCH_BATCH; j++) {
+			if (cobj_create_in(arena, c) == NULL)
+				errx(EX_OSERR, "cobj_create_in failed");
+		}
+		cobj_arena_reset(arena);
+	}
+
+	cobj_arena_destroy(arena);
+}
+
+void
+bench_zone(u_long iters, int maxthreads)
+{
+	cobj_t pin[2];
+	int n;
+
+	if (cobj_class_zone(&bench_zone_class, NULL, NULL) != 0)
+		errx(EX_SOFTWARE, "cobj_class_zone failed");
+
+	if ((pin[0] = cobj_create(&bench_calloc_class)) == NULL ||
+	    (pin[1] = cobj_create(&bench_zone_class)) == NULL)
+		errx(EX_OSERR, "cobj_create failed");
+
+	iters = (iters + BENCH_BATCH - 1) / BENCH_BATCH * BENCH_BATCH;
+
+	for (n = 1;; n *= 2) {
+		if (n > maxthreads)
+			n = maxthreads;
+
+		bench_report("create_delete_calloc", n, iters * n,
+		    bench_threads(n, bench_zone_churn, &bench_calloc_class,
+		    iters));
+		bench_report("create_delete_zone", n, iters * n,
+		    bench_threads(n, bench_zone_churn, &bench_zone_class,
+		    iters));
+		bench_report("create_reset_arena", n, iters * n,
+		    bench_threads(n, bench_zone_arena, &bench_calloc_class,
+		    iters));
+
+		if (n == maxthreads)
+			break;
+	}
+
+	(void)cobj_delete(pin[0]);
+	(void)cobj_delete(pin[1]);
+}
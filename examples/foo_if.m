@@ -37,7 +37,7 @@ CODE {
 	foo_common(cobj_t o)
 	{
 		(void)printf("%s: instance of %s_class \n", 
-			__func__, o->ops->cls->name);
+			__func__, COBJ_OPS(o)->cls->name);
 	}
 };
 
@@ -0,0 +1,322 @@
+/*-
+ * Copyright (c) 2019 Henning Matyschok
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+
+#include <stdlib.h>
+
+#include <libcobj.h>
+
+/*
+ * A bounded, lock-free multi-producer multi-consumer queue
+ * implementing tailq_if(3), usable in place of tailq_class(3)
+ * by several threads at once.
+ *
+ * The ring is part of the object, so enqueueing never allocates.
+ * Every slot carries a sequence number which tells producers and
+ * consumers whose turn it is: a slot at position pos is free for
+ * the producer claiming pos when its sequence is pos, and holds
+ * data for the consumer claiming pos when it is pos + 1. Head and
+ * tail are kept on cache lines of their own.
+ */
+
+#include "tailq_if.h"
+
+#define LFQ_SIZE	1024		/* slots, a power of two */
+#define LFQ_MASK	(LFQ_SIZE - 1)
+
+/*
+ * Forward declarations.
+ */
+typedef struct lfq_obj	*lfq_obj_t;
+
+struct lfq_slot {
+	u_long		ls_seq;
+	void		*ls_data;
+};
+
+/*
+ * Software-context for an instance of lfq_class(3).
+ */
+struct lfq_obj {
+	COBJ_FIELDS;
+	char		lo_pad0[COBJ_CACHE_LINE];
+	u_long		lo_head;	/* next position to dequeue */
+	char		lo_pad1[COBJ_CACHE_LINE];
+	u_long		lo_tail;	/* next position to enqueue */
+	char		lo_pad2[COBJ_CACHE_LINE];
+	struct lfq_slot	lo_ring[LFQ_SIZE];
+};
+
+/*
+ * Enqueue, fails if the queue is full.
+ */
+static int
+lfq_add(cobj_t o, void *arg)
+{
+	struct lfq_slot *ls;
+	lfq_obj_t lo;
+	u_long pos, seq;
+
+	if (arg == NULL)
+		return (-1);
+
+	if ((lo = (lfq_obj_t)o) == NULL)
+		return (-1);
+
+	pos = __atomic_load_n(&lo->lo_tail, __ATOMIC_RELAXED);
+
+	for (;;) {
+		ls = &lo->lo_ring[pos & LFQ_MASK];
+		seq = __atomic_load_n(&ls->ls_seq, __ATOMIC_ACQUIRE);
+
+		if ((long)(seq - pos) == 0) {
+			if (__atomic_compare_exchange_n(&lo->lo_tail, &pos,
+			    pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if ((long)(seq - pos) < 0)
+			return (-1);
+		else
+			pos = __atomic_load_n(&lo->lo_tail, __ATOMIC_RELAXED);
+	}
+
+	ls->ls_data = arg;
+	__atomic_store_n(&ls->ls_seq, pos + 1, __ATOMIC_RELEASE);
+
+	return (0);
+}
+
+/*
+ * Dequeue, returns NULL if the queue is empty.
+ */
+static void *
+lfq_poll(cobj_t o)
+{
+	struct lfq_slot *ls;
+	lfq_obj_t lo;
+	u_long pos, seq;
+	void *data;
+
+	if ((lo = (lfq_obj_t)o) == NULL)
+		return (NULL);
+
+	pos = __atomic_load_n(&lo->lo_head, __ATOMIC_RELAXED);
+
+	for (;;) {
+		ls = &lo->lo_ring[pos & LFQ_MASK];
+		seq = __atomic_load_n(&ls->ls_seq, __ATOMIC_ACQUIRE);
+
+		if ((long)(seq - (pos + 1)) == 0) {
+			if (__atomic_compare_exchange_n(&lo->lo_head, &pos,
+			    pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if ((long)(seq - (pos + 1)) < 0)
+			return (NULL);
+		else
+			pos = __atomic_load_n(&lo->lo_head, __ATOMIC_RELAXED);
+	}
+
+	data = ls->ls_data;
+	ls->ls_data = NULL;
+	__atomic_store_n(&ls->ls_seq, pos + LFQ_SIZE, __ATOMIC_RELEASE);
+
+	return (data);
+}
+
+/*
+ * Claim as many consecutive slots as are ready, up to n, with
+ * a single CAS on the position. A slot at pos + i is ready when
+ * its sequence is pos + i + off. Since the position only moves
+ * forward, the claimed slots can't have been taken by anyone
+ * else if the CAS succeeds.
+ */
+static int
+lfq_claim(lfq_obj_t lo, u_long *posp, u_long off, int n, u_long *startp)
+{
+	u_long pos, seq;
+	int i;
+
+	if (n <= 0)
+		return (0);
+
+	pos = __atomic_load_n(posp, __ATOMIC_RELAXED);
+
+	for (;;) {
+		for (i = 0; i < n; i++) {
+			seq = __atomic_load_n(
+			    &lo->lo_ring[(pos + i) & LFQ_MASK].ls_seq,
+			    __ATOMIC_ACQUIRE);
+			if (seq != pos + i + off)
+				break;
+		}
+
+		if (i == 0) {
+			seq = __atomic_load_n(&lo->lo_ring[pos & LFQ_MASK].ls_seq,
+			    __ATOMIC_ACQUIRE);
+			if ((long)(seq - (pos + off)) < 0)
+				return (0);
+			pos = __atomic_load_n(posp, __ATOMIC_RELAXED);
+			continue;
+		}
+
+		if (__atomic_compare_exchange_n(posp, &pos, pos + i, 0,
+		    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			break;
+	}
+
+	*startp = pos;
+
+	return (i);
+}
+
+/*
+ * Enqueue an array, as much of it as fits.
+ */
+static int
+lfq_add_bulk(cobj_t o, void **args, int n)
+{
+	struct lfq_slot *ls;
+	lfq_obj_t lo;
+	u_long pos;
+	int i, k;
+
+	if ((lo = (lfq_obj_t)o) == NULL || args == NULL)
+		return (-1);
+
+	for (k = 0; k < n; k++) {
+		if (args[k] == NULL)
+			break;
+	}
+
+	if ((k = lfq_claim(lo, &lo->lo_tail, 0, k, &pos)) == 0)
+		return (0);
+
+	for (i = 0; i < k; i++) {
+		ls = &lo->lo_ring[(pos + i) & LFQ_MASK];
+		ls->ls_data = args[i];
+		__atomic_store_n(&ls->ls_seq, pos + i + 1, __ATOMIC_RELEASE);
+	}
+
+	return (k);
+}
+
+/*
+ * Dequeue into an array.
+ */
+static int
+lfq_poll_bulk(cobj_t o, void **args, int n)
+{
+	struct lfq_slot *ls;
+	lfq_obj_t lo;
+	u_long pos;
+	int i, k;
+
+	if ((lo = (lfq_obj_t)o) == NULL || args == NULL)
+		return (-1);
+
+	if ((k = lfq_claim(lo, &lo->lo_head, 1, n, &pos)) == 0)
+		return (0);
+
+	for (i = 0; i < k; i++) {
+		ls = &lo->lo_ring[(pos + i) & LFQ_MASK];
+		args[i] = ls->ls_data;
+		ls->ls_data = NULL;
+		__atomic_store_n(&ls->ls_seq, pos + i + LFQ_SIZE,
+		    __ATOMIC_RELEASE);
+	}
+
+	return (k);
+}
+
+/*
+ * Flush queue.
+ */
+static int
+lfq_flush(cobj_t o)
+{
+
+	if (o == NULL)
+		return (-1);
+
+	while (lfq_poll(o) != NULL)
+		;
+
+	return (0);
+}
+
+/*
+ * Ctor.
+ */
+static cobj_t
+lfq_create(cobj_class_t c)
+{
+	lfq_obj_t lo;
+	u_long i;
+
+	if ((lo = (lfq_obj_t)cobj_create(c)) == NULL)
+		return (NULL);
+
+	for (i = 0; i < LFQ_SIZE; i++)
+		lo->lo_ring[i].ls_seq = i;
+
+	return ((cobj_t)lo);
+}
+
+/*
+ * Dtor, refuses objects of another class.
+ */
+static int
+lfq_destroy(cobj_class_t c, cobj_t o)
+{
+
+	if (!cobj_isa(o, c))
+		return (-1);
+
+	if (lfq_flush(o) != 0)
+		return (-1);
+
+	return (cobj_delete(o));
+}
+
+static cobj_method_t lfq_methods[] = {
+	/* public methods */
+	COBJ_METHOD(tailq_add,		lfq_add),
+	COBJ_METHOD(tailq_poll,		lfq_poll),
+	COBJ_METHOD(tailq_add_bulk,		lfq_add_bulk),
+	COBJ_METHOD(tailq_poll_bulk,		lfq_poll_bulk),
+	COBJ_METHOD(tailq_flush,		lfq_flush),
+
+	/* static methods */
+	COBJ_METHOD(tailq_create,		lfq_create),
+	COBJ_METHOD(tailq_destroy,		lfq_destroy),
+	COBJ_METHOD_END
+};
+
+#ifdef COBJ_PRECOMPILED
+#include "lfq_class_ops.h"
+#endif
+
+DEFINE_CLASS(lfq, lfq_methods, sizeof(struct lfq_obj));
@@ -28,6 +28,7 @@
 
 #include <stdlib.h>
 #include <sysexits.h>
+#include <unistd.h>
 
 #include <libcobj.h>
 #include "foo_if.h"
@@ -46,7 +47,7 @@ DEFINE_CLASS(null, null_methods, sizeof(struct cobj));
 static void
 own_method(cobj_t o) {
   (void)printf("%s: instance of %s_class \n",
-               __func__, o->ops->cls->name);
+               __func__, COBJ_OPS(o)->cls->name);
 }
 
 static void
@@ -71,6 +72,7 @@ DEFINE_CLASS(foo, foo_methods, sizeof(struct cobj));
 #include "tailq_if.h"
 
 DECLARE_CLASS(tailq_class);
+DECLARE_CLASS(lfq_class);
 
 int item_a = 1;
 int item_b = 2;
@@ -80,6 +82,10 @@ int *tmp;
 int main(int argc, char *argv[]) {
   cobj_t o;
 
+#ifdef COBJ_TRACE
+  (void)cobj_trace_enable(1);
+#endif
+
   /*
 	 * Initialize foo_class(3) and call its
 	 * statically defined method, if any.
@@ -139,5 +145,29 @@ int main(int argc, char *argv[]) {
 	 */
   (void)TAILQ_DESTROY(&tailq_class, o);
 
+  /*
+	 * Same again with lfq_class(3), a lock-free
+	 * implementation of tailq_if(3).
+	 */
+  (void)cobj_class_compile(&lfq_class);
+  o = TAILQ_CREATE(&lfq_class);
+
+  (void)TAILQ_ADD(o, &item_a);
+  (void)TAILQ_ADD(o, &item_b);
+  (void)TAILQ_ADD(o, &item_c);
+
+  while ((tmp = (int *)TAILQ_POLL(o)) != NULL)
+    (void)printf("%s: item: %d\n", __func__, *tmp);
+
+  (void)TAILQ_DESTROY(&lfq_class, o);
+
+#ifdef COBJ_TRACE
+  /*
+	 * Report the calls made through either interface.
+	 */
+  (void)cobj_trace_dump(STDERR_FILENO, "foo", NULL);
+  (void)cobj_trace_dump(STDERR_FILENO, "tailq", NULL);
+#endif
+
   exit(EX_OK);
 }
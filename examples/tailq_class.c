@@ -27,6 +27,7 @@
 #include <sys/types.h>
 #include <sys/queue.h>
 
+#include <stddef.h>
 #include <stdlib.h>
 
 #include <libcobj.h>
@@ -35,12 +36,21 @@
  * Example for a simplefied queue(3).
  */
 
+#include "cobj_snap_if.h"
 #include "tailq_if.h"
 
+/*
+ * Items are carved from chunks of TAILQ_CHUNK and recycled
+ * through a free list of the object, so that enqueueing
+ * only allocates when the queue grows beyond its peak.
+ */
+#define TAILQ_CHUNK	64
+
 /*
  * Forward declarations.
  */
 typedef struct tailq_item	*tailq_item_t;
+typedef struct tailq_chunk	*tailq_chunk_t;
 typedef struct tailq_obj	*tailq_obj_t;
 
 /*
@@ -51,14 +61,50 @@ struct tailq_item {
 	void		*ti_data;
 };
 
+struct tailq_chunk {
+	SLIST_ENTRY(tailq_chunk) tc_next;
+	struct tailq_item tc_items[TAILQ_CHUNK];
+};
+
 /*
  * Software-context for an instance of tailq_class(3).
  */
 struct tailq_obj {
 	COBJ_FIELDS;
 	TAILQ_HEAD(, tailq_item) to_cache;
+	TAILQ_HEAD(, tailq_item) to_free;
+	SLIST_HEAD(, tailq_chunk) to_chunks;
 };
 
+/*
+ * Take an item off the free list, refilling it with
+ * a new chunk if it is empty.
+ */
+static tailq_item_t
+tailq_item_alloc(tailq_obj_t to)
+{
+	tailq_chunk_t tc;
+	tailq_item_t ti;
+	int i;
+	
+	if ((ti = TAILQ_FIRST(&to->to_free)) == NULL) {
+		if ((tc = malloc(sizeof(struct tailq_chunk))) == NULL)
+			return (NULL);
+		
+		SLIST_INSERT_HEAD(&to->to_chunks, tc, tc_next);
+		
+		for (i = 0; i < TAILQ_CHUNK; i++)
+			TAILQ_INSERT_TAIL(&to->to_free, &tc->tc_items[i],
+			    ti_next);
+		
+		ti = TAILQ_FIRST(&to->to_free);
+	}
+	
+	TAILQ_REMOVE(&to->to_free, ti, ti_next);
+	
+	return (ti);
+}
+
 /*
  * Enqueue.
  */
@@ -74,7 +120,7 @@ tailq_add(cobj_t o, void *arg)
 	if ((to = (tailq_obj_t)o) == NULL)
 		return (-1);
 	
-	if ((ti = calloc(1, sizeof(struct tailq_item))) == NULL)
+	if ((ti = tailq_item_alloc(to)) == NULL)
 		return (-1);
 
 	ti->ti_data = arg;
@@ -105,30 +151,70 @@ tailq_poll(cobj_t o)
 	data = ti->ti_data;
 	ti->ti_data = NULL;
 	
-	free(ti);
+	TAILQ_INSERT_HEAD(&to->to_free, ti, ti_next);
 	
 	return (data);
 }
 
 /*
- * Flush queue.
+ * Enqueue an array, stops at the first NULL
+ * entry or when out of memory.
+ */
+static int
+tailq_add_bulk(cobj_t o, void **args, int n)
+{
+	int i;
+	
+	if (o == NULL || args == NULL)
+		return (-1);
+	
+	for (i = 0; i < n; i++) {
+		if (tailq_add(o, args[i]) != 0)
+			break;
+	}
+	
+	return (i);
+}
+
+/*
+ * Dequeue into an array.
+ */
+static int
+tailq_poll_bulk(cobj_t o, void **args, int n)
+{
+	int i;
+	
+	if (o == NULL || args == NULL)
+		return (-1);
+	
+	for (i = 0; i < n; i++) {
+		if ((args[i] = tailq_poll(o)) == NULL)
+			break;
+	}
+	
+	return (i);
+}
+
+/*
+ * Flush queue, releasing all chunks at once.
  */
 static int
 tailq_flush(cobj_t o)
 {
 	tailq_obj_t to;
-	tailq_item_t ti;
+	tailq_chunk_t tc;
 	
 	if ((to = (tailq_obj_t)o) == NULL)
 		return (-1);
 	
-	while (!TAILQ_EMPTY(&to->to_cache)) {
-		ti = TAILQ_FIRST(&to->to_cache);
-		TAILQ_REMOVE(&to->to_cache, ti, ti_next);	
-		ti->ti_data = NULL;
-		free(ti);
+	while ((tc = SLIST_FIRST(&to->to_chunks)) != NULL) {
+		SLIST_REMOVE_HEAD(&to->to_chunks, tc_next);
+		free(tc);
 	}
 	
+	TAILQ_INIT(&to->to_cache);
+	TAILQ_INIT(&to->to_free);
+	
 	return (0);	
 }
 
@@ -144,28 +230,110 @@ tailq_create(cobj_class_t c)
 		return (NULL);
 	
 	TAILQ_INIT(&to->to_cache);
+	TAILQ_INIT(&to->to_free);
+	SLIST_INIT(&to->to_chunks);
 	
 	return ((cobj_t)to);
 }
 
 /*
- * Dtor.
+ * Dtor, refuses objects of another class.
  */
 static int
 tailq_destroy(cobj_class_t c, cobj_t o)
 {
 
+	if (!cobj_isa(o, c))
+		return (-1);
+
 	if (tailq_flush(o) != 0)
 		return (-1);
 		
 	return (cobj_delete(o));
 }
 
+/*
+ * Save the enqueued items into a snapshot, as one array linked by
+ * offsets. The data they hold is saved as it is, a snapshot of a
+ * queue of pointers is only useful if those stay valid. Chunks
+ * and the free list are not saved, the restored queue allocates
+ * new ones when it grows.
+ */
+static int
+tailq_snap_save(cobj_t o, cobj_snap_t snap, u_long off)
+{
+	tailq_obj_t to, copy;
+	tailq_item_t ti, items;
+	u_long ioff, prev;
+	int i, n;
+
+	to = (tailq_obj_t)o;
+
+	n = 0;
+	TAILQ_FOREACH(ti, &to->to_cache, ti_next)
+		n++;
+
+	ioff = 0;
+	if (n > 0 &&
+	    (ioff = cobj_snap_alloc(snap, n * sizeof(struct tailq_item))) == 0)
+		return (-1);
+
+	copy = cobj_snap_at(snap, off);
+	items = cobj_snap_at(snap, ioff);
+
+	prev = off + offsetof(struct tailq_obj, to_cache.tqh_first);
+	i = 0;
+	TAILQ_FOREACH(ti, &to->to_cache, ti_next) {
+		items[i].ti_data = ti->ti_data;
+		items[i].ti_next.tqe_next = (i + 1 < n) ? (tailq_item_t)
+		    (ioff + (i + 1) * sizeof(struct tailq_item)) : NULL;
+		items[i].ti_next.tqe_prev = (tailq_item_t *)prev;
+		prev = ioff + i * sizeof(struct tailq_item) +
+		    offsetof(struct tailq_item, ti_next.tqe_next);
+		i++;
+	}
+
+	copy->to_cache.tqh_first = (tailq_item_t)ioff;
+	copy->to_cache.tqh_last = (tailq_item_t *)prev;
+	copy->to_free.tqh_first = NULL;
+	copy->to_free.tqh_last = (tailq_item_t *)(off +
+	    offsetof(struct tailq_obj, to_free.tqh_first));
+	SLIST_INIT(&copy->to_chunks);
+
+	return (0);
+}
+
+/*
+ * Relink a queue restored from a snapshot mapped at base.
+ */
+static int
+tailq_snap_load(cobj_t o, void *base)
+{
+	tailq_obj_t to;
+	tailq_item_t ti;
+
+	to = (tailq_obj_t)o;
+
+	COBJ_SNAP_PTR(base, to->to_cache.tqh_first);
+	COBJ_SNAP_PTR(base, to->to_cache.tqh_last);
+	COBJ_SNAP_PTR(base, to->to_free.tqh_last);
+
+	for (ti = TAILQ_FIRST(&to->to_cache); ti != NULL;
+	    ti = COBJ_SNAP_PTR(base, ti->ti_next.tqe_next))
+		COBJ_SNAP_PTR(base, ti->ti_next.tqe_prev);
+
+	return (0);
+}
+
 static cobj_method_t tailq_methods[] = {
 	/* public methods */
 	COBJ_METHOD(tailq_add,		tailq_add),
 	COBJ_METHOD(tailq_poll,		tailq_poll),
+	COBJ_METHOD(tailq_add_bulk,		tailq_add_bulk),
+	COBJ_METHOD(tailq_poll_bulk,		tailq_poll_bulk),
 	COBJ_METHOD(tailq_flush,		tailq_flush),
+	COBJ_METHOD(cobj_snap_save,		tailq_snap_save),
+	COBJ_METHOD(cobj_snap_load,		tailq_snap_load),
 	
 	/* static methods */
 	COBJ_METHOD(tailq_create,		tailq_create),
@@ -173,4 +341,8 @@ static cobj_method_t tailq_methods[] = {
 	COBJ_METHOD_END
 };
 
+#ifdef COBJ_PRECOMPILED
+#include "tailq_class_ops.h"
+#endif
+
 DEFINE_CLASS(tailq, tailq_methods, sizeof(struct tailq_obj));
@@ -44,6 +44,26 @@ METHOD void * poll {
 	cobj_t o;
 };
 
+#
+# Enqueue up to n items from an array, returns the
+# number of items enqueued.
+#
+METHOD int add_bulk {
+	cobj_t o;
+	void **args;
+	int n;
+};
+
+#
+# Dequeue up to n items into an array, returns the
+# number of items dequeued.
+#
+METHOD int poll_bulk {
+	cobj_t o;
+	void **args;
+	int n;
+};
+
 #
 # Delete all enqueued items.
 #
@@ -51,28 +51,68 @@
 #include <sys/cdefs.h>
 #include <sys/types.h>
 
-#include <err.h>
+#include <stdint.h>
 #include <stdlib.h>
-#include <sysexits.h>
 
 #include <libcobj.h>
 
-#ifdef COBJ_STATS
-u_int kobj_lookup_hits = 0;
-u_int kobj_lookup_misses = 0;
-#endif
+#include "cobj_private.h"
+
+#ifdef COBJ_COMPACT
+/*
+ * Ops tables of the classes, by index. Index 0 is never assigned,
+ * it stands for an object without a table.
+ */
+cobj_ops_t cobj_registry[COBJ_REGISTRY_SIZE];
+
+static u_int cobj_registry_next = 1;
+
+/*
+ * Assign the class its index on first use, and point its entry at
+ * the table given to its instances. The table of a class only
+ * changes while it has none, so the entry is only written when
+ * the first instance after that is initialized. Returns 0 once
+ * the registry is full.
+ */
+u_int
+cobj_registry_enter(cobj_class_t cls, cobj_ops_t ops) {
+  u_int cid, prev;
+
+  if ((cid = __atomic_load_n(&cls->cid, __ATOMIC_ACQUIRE)) == 0) {
+    cid = __atomic_fetch_add(&cobj_registry_next, 1, __ATOMIC_RELAXED);
+    if (cid >= COBJ_REGISTRY_SIZE)
+      return (0);
+
+    prev = 0;
+    if (!__atomic_compare_exchange_n(&cls->cid, &prev, cid, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+      cid = prev;
+  }
 
-sem_t cobj_lock;
+  if (__atomic_load_n(&cobj_registry[cid], __ATOMIC_ACQUIRE) != ops)
+    __atomic_store_n(&cobj_registry[cid], ops, __ATOMIC_RELEASE);
+
+  return (cid);
+}
+#endif /* COBJ_COMPACT */
 
 /*
  * Allocate and initialize the new object.
  */
 
-static void
-cobj_init_common(cobj_t obj, cobj_class_t cls) {
+int cobj_init_ops(cobj_t obj, cobj_class_t cls) {
+  cobj_ops_t ops;
 
-  obj->ops = cls->ops;
-  cls->refs++;
+  ops = __atomic_load_n(&cls->ops, __ATOMIC_ACQUIRE);
+
+#ifdef COBJ_COMPACT
+  if ((obj->cid = cobj_registry_enter(cls, ops)) == 0)
+    return (-1);
+#else
+  obj->ops = ops;
+#endif
+
+  return (0);
 }
 
 int cobj_init_static(cobj_t obj, cobj_class_t cls) {
@@ -82,7 +122,12 @@ int cobj_init_static(cobj_t obj, cobj_class_t cls) {
   if (obj == NULL)
     return (-1);
 
-  cobj_init_common(obj, cls);
+  cobj_class_ref(cls, 0);
+
+  if (cobj_init_ops(obj, cls) != 0) {
+    (void)cobj_class_unref(cls);
+    return (-1);
+  }
 
   return (0);
 }
@@ -96,35 +141,36 @@ int cobj_init(cobj_t obj, cobj_class_t cls) {
 
   if (obj == NULL)
     return (-1);
-retry:
-  sem_wait(&cobj_lock);
+
+  /*
+	 * The reference pins the ops table, once it is
+	 * published it stays until the last instance is
+	 * gone.
+	 */
+  cobj_class_ref(cls, 1);
 
   /*
 	 * Consider compiling the class' method table.
 	 */
-  if (cls->ops == NULL) {
-    /*
-		 * cobj_class_compile doesn't want the lock held
-		 * because of the call to calloc(3) - we drop the lock
-		 * and re-try.
-		 */
-    sem_post(&cobj_lock);
-
-    if (cobj_class_compile(cls) != 0)
+  if (__atomic_load_n(&cls->ops, __ATOMIC_ACQUIRE) == NULL) {
+    if (cobj_class_compile(cls) != 0) {
+      (void)cobj_class_unref(cls);
       return (-1);
-
-    goto retry;
+    }
   }
 
-  cobj_init_common(obj, cls);
-
-  sem_post(&cobj_lock);
+  if (cobj_init_ops(obj, cls) != 0) {
+    if (cobj_class_unref(cls))
+      (void)cobj_class_free(cls);
+    return (-1);
+  }
 
   return (0);
 }
 
 cobj_t
 cobj_create(cobj_class_t cls) {
+  cobj_allocator_t a;
   cobj_t obj;
 
   if (cls == NULL)
@@ -133,11 +179,13 @@ cobj_create(cobj_class_t cls) {
   if (cls->size < sizeof(struct cobj))
     return (NULL);
 
-  if ((obj = calloc(1, cls->size)) == NULL)
+  a = COBJ_ALLOCATOR(cls);
+
+  if ((obj = a->alloc(a, cls->size)) == NULL)
     return (NULL);
 
   if (cobj_init(obj, cls) != 0) {
-    free(obj);
+    a->free(a, obj, cls->size);
     return (NULL);
   }
 
@@ -148,49 +196,115 @@ cobj_create(cobj_class_t cls) {
  * Destroy an object.
  */
 int cobj_delete(cobj_t obj) {
+  cobj_allocator_t a;
   cobj_class_t cls;
-  int refs;
 
   if (obj == NULL)
     return (-1);
 
-  cls = obj->ops->cls;
+  cls = COBJ_OPS(obj)->cls;
 
   /*
 	 * Consider freeing the compiled method table for the class
-	 * after its last instance is deleted. As an optimisation, we
-	 * should defer this for a short while to avoid thrashing.
+	 * after its last instance is deleted. The table is retired
+	 * for a grace period rather than freed, see cobj_epoch.c.
 	 */
   COBJ_ASSERT(MA_NOTOWNED);
-  sem_wait(&cobj_lock);
-  cls->refs--;
-  refs = cls->refs;
-  sem_post(&cobj_lock);
 
-  if (refs == 0)
+  if (cobj_class_unref(cls))
     cobj_class_free(cls);
 
-  obj->ops = NULL;
-  free(obj);
+  COBJ_CLEAR(obj);
+
+  a = COBJ_ALLOCATOR(cls);
+  a->free(a, obj, cls->size);
 
   return (0);
 }
 
 /*
- * Initialize POSIX semaphore.
+ * Resolve a method for calls outside of COBJ_CALL_METHOD.
  */
-static __attribute__((constructor)) void
-cobj_ctor(void) {
+cobjop_t
+cobj_bind(cobj_t obj, cobjop_desc_t desc, u_long *genp) {
+  cobj_method_t **cep, *ce;
+  cobj_ops_t ops;
+
+  if (obj == NULL || desc == NULL)
+    return (NULL);
+
+  ops = COBJ_OPS(obj);
+  cep = &ops->cache[COBJ_OPS_SLOT(ops, desc->id)];
+
+  if ((ce = *cep)->desc != desc)
+    ce = cobj_call_method(ops->cls, cep, desc);
+
+  if (genp != NULL)
+    *genp = ops->gen;
+
+  return (ce->func);
+}
+
+/*
+ * Fill inline caches. An entry is published by bumping the count,
+ * entries below it never change, so a reader never sees a
+ * generation paired with the function of another one.
+ */
+cobjop_t
+cobj_ic_miss(struct cobj_ic *ic, cobj_ops_t ops, cobjop_desc_t desc) {
+  cobj_method_t **cep, *ce;
+  u_int busy, i, n;
+
+  cep = &ops->cache[COBJ_OPS_SLOT(ops, desc->id)];
+
+  if ((ce = *cep)->desc != desc)
+    ce = cobj_call_method(ops->cls, cep, desc);
 
-  if (sem_init(&cobj_lock, 0, 1) != 0)
-    errx(EX_OSERR, "%s: sem_init(3) failed.", __func__);
+  if (__atomic_load_n(&ic->n, __ATOMIC_RELAXED) >= COBJ_IC_WAYS)
+    return (ce->func);
+
+  busy = 0;
+  if (!__atomic_compare_exchange_n(&ic->busy, &busy, 1, 0,
+                                   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    return (ce->func);
+
+  n = ic->n;
+  for (i = 0; i < n; i++) {
+    if (ic->e[i].gen == ops->gen)
+      break;
+  }
+
+  if (i == n && n < COBJ_IC_WAYS) {
+    ic->e[n].gen = ops->gen;
+    ic->e[n].func = ce->func;
+    __atomic_store_n(&ic->n, n + 1, __ATOMIC_RELEASE);
+  }
+
+  __atomic_store_n(&ic->busy, 0, __ATOMIC_RELEASE);
+
+  return (ce->func);
 }
 
 /*
- * Finalize.
+ * Group an array of objects by their ops table, for the
+ * batch wrappers generated by makeobjops.awk.
  */
-static __attribute__((destructor)) void
-cobj_dtor(void) {
 
-  (void)(sem_destroy)(&cobj_lock);
+static int
+cobj_ops_cmp(const void *a, const void *b) {
+  cobj_t oa = *(cobj_t const *)a, ob = *(cobj_t const *)b;
+  uintptr_t pa, pb;
+
+  pa = (oa != NULL) ? (uintptr_t)COBJ_OPS(oa) : 0;
+  pb = (ob != NULL) ? (uintptr_t)COBJ_OPS(ob) : 0;
+
+  return ((pa > pb) - (pa < pb));
+}
+
+void cobj_sort_by_ops(cobj_t *objs, size_t n) {
+
+  if (objs == NULL || n < 2)
+    return;
+
+  qsort(objs, n, sizeof(cobj_t), cobj_ops_cmp);
 }
@@ -0,0 +1,353 @@
+/*-
+ * Copyright (c) 2019 Henning Matyschok
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <libcobj.h>
+
+#include "cobj_private.h"
+
+/*
+ * The default allocator.
+ */
+
+static void *
+cobj_default_alloc(cobj_allocator_t a, size_t size) {
+
+  (void)a;
+
+  return (calloc(1, size));
+}
+
+static void
+cobj_default_free(cobj_allocator_t a, void *mem, size_t size) {
+
+  (void)a;
+  (void)size;
+
+  free(mem);
+}
+
+static struct cobj_allocator cobj_default_allocator = {
+    cobj_default_alloc,
+    cobj_default_free,
+};
+
+cobj_allocator_t cobj_allocator = &cobj_default_allocator;
+
+void cobj_set_allocator(cobj_allocator_t a) {
+
+  cobj_allocator = (a != NULL) ? a : &cobj_default_allocator;
+}
+
+/*
+ * Objects allocated before cannot be freed with
+ * another allocator, so this has to be done before
+ * the first instance of the class is created.
+ */
+int cobj_class_allocator(cobj_class_t cls, cobj_allocator_t a) {
+
+  if (cls == NULL)
+    return (-1);
+
+  if (cobj_class_refs(cls) != 0)
+    return (-1);
+
+  __atomic_store_n(&cls->allocator, a, __ATOMIC_RELEASE);
+
+  return (0);
+}
+
+/*
+ * Arenas.
+ */
+
+#define COBJ_ARENA_CHUNK 65536
+#define COBJ_ARENA_ALIGN sizeof(long double)
+#define COBJ_ARENA_ROUND(n) \
+  (((n) + COBJ_ARENA_ALIGN - 1) & ~(COBJ_ARENA_ALIGN - 1))
+
+struct cobj_arena_chunk {
+  struct cobj_arena_chunk *next;
+  size_t size;  /* usable bytes */
+  size_t used;  /* bytes handed out */
+};
+
+#define COBJ_ARENA_HDR COBJ_ARENA_ROUND(sizeof(struct cobj_arena_chunk))
+
+/*
+ * Classes with instances in the arena, each
+ * holding one reference until the arena is reset.
+ */
+struct cobj_arena_class {
+  cobj_class_t cls;
+};
+
+struct cobj_arena {
+  struct cobj_allocator allocator;
+  size_t chunksize;                 /* default chunk size */
+  struct cobj_arena_chunk *chunks;  /* current chunk first */
+  struct cobj_arena_class *classes;
+  int nclasses;
+  int maxclasses;
+};
+
+/*
+ * Memory is aligned to the largest power of two dividing its size,
+ * up to COBJ_ARENA_ALIGN, which is all a type of that size can
+ * need. Small objects of different classes are packed back to back
+ * that way, padding between them is zeroed.
+ */
+static void *
+cobj_arena_alloc(cobj_allocator_t a, size_t size) {
+  struct cobj_arena *arena;
+  struct cobj_arena_chunk *chunk;
+  size_t align, off, len;
+  void *mem;
+
+  arena = (struct cobj_arena *)a;
+
+  if ((align = size & -size) == 0 || align > COBJ_ARENA_ALIGN)
+    align = COBJ_ARENA_ALIGN;
+
+  chunk = arena->chunks;
+  off = (chunk != NULL) ? (chunk->used + align - 1) & ~(align - 1) : 0;
+
+  if (chunk == NULL || off > chunk->size || chunk->size - off < size) {
+    /*
+		 * Start a new chunk, large allocations get
+		 * one of their own.
+		 */
+    len = (size > arena->chunksize) ? size : arena->chunksize;
+
+    if ((chunk = malloc(COBJ_ARENA_HDR + len)) == NULL)
+      return (NULL);
+
+    chunk->size = len;
+    chunk->used = 0;
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    off = 0;
+  }
+
+  mem = (char *)chunk + COBJ_ARENA_HDR + off;
+  memset((char *)chunk + COBJ_ARENA_HDR + chunk->used, 0,
+         off + size - chunk->used);
+  chunk->used = off + size;
+
+  return (mem);
+}
+
+static void
+cobj_arena_free(cobj_allocator_t a, void *mem, size_t size) {
+
+  /*
+	 * Memory is only released by cobj_arena_reset(3).
+	 */
+  (void)a;
+  (void)mem;
+  (void)size;
+}
+
+cobj_arena_t
+cobj_arena_create(size_t chunksize) {
+  cobj_arena_t arena;
+
+  if ((arena = calloc(1, sizeof(*arena))) == NULL)
+    return (NULL);
+
+  arena->allocator.alloc = cobj_arena_alloc;
+  arena->allocator.free = cobj_arena_free;
+  arena->chunksize = (chunksize != 0) ? COBJ_ARENA_ROUND(chunksize)
+                                      : COBJ_ARENA_CHUNK;
+
+  return (arena);
+}
+
+cobj_allocator_t
+cobj_arena_allocator(cobj_arena_t arena) {
+
+  return ((arena != NULL) ? &arena->allocator : NULL);
+}
+
+/*
+ * Take the arena's reference on the class, once.
+ */
+
+static int
+cobj_arena_ref(cobj_arena_t arena, cobj_class_t cls) {
+  struct cobj_arena_class *ac;
+  int n;
+
+  for (n = arena->nclasses - 1; n >= 0; n--) {
+    if (arena->classes[n].cls == cls)
+      return (0);
+  }
+
+  if (arena->nclasses == arena->maxclasses) {
+    n = (arena->maxclasses != 0) ? 2 * arena->maxclasses : 8;
+
+    if ((ac = realloc(arena->classes, n * sizeof(*ac))) == NULL)
+      return (-1);
+
+    arena->classes = ac;
+    arena->maxclasses = n;
+  }
+
+  cobj_class_ref(cls, 1);
+
+  if (__atomic_load_n(&cls->ops, __ATOMIC_ACQUIRE) == NULL &&
+      cobj_class_compile(cls) != 0) {
+    if (cobj_class_unref(cls))
+      (void)cobj_class_free(cls);
+    return (-1);
+  }
+
+  arena->classes[arena->nclasses++].cls = cls;
+
+  return (0);
+}
+
+cobj_t
+cobj_create_in(cobj_arena_t arena, cobj_class_t cls) {
+  cobj_t obj;
+
+  if (arena == NULL || cls == NULL)
+    return (NULL);
+
+  if (cls->size < sizeof(struct cobj))
+    return (NULL);
+
+  if (cobj_arena_ref(arena, cls) != 0)
+    return (NULL);
+
+  if ((obj = cobj_arena_alloc(&arena->allocator, cls->size)) == NULL)
+    return (NULL);
+
+  if (cobj_init_ops(obj, cls) != 0)
+    return (NULL);
+
+  return (obj);
+}
+
+/*
+ * Walk the objects created by cobj_create_in(3), chunk by chunk,
+ * starting from a zeroed cursor. Memory taken through the arena's
+ * allocator must not be walked. Returns NULL at the end.
+ */
+cobj_t
+cobj_arena_next(cobj_arena_t arena, struct cobj_arena_cursor *cur) {
+  struct cobj_arena_chunk *chunk;
+  cobj_ops_t ops;
+  cobj_t obj;
+
+  if (arena == NULL || cur == NULL)
+    return (NULL);
+
+  if ((chunk = cur->chunk) == NULL) {
+    if (cur->off != 0)
+      return (NULL);
+    chunk = arena->chunks;
+  }
+
+  for (; chunk != NULL; chunk = chunk->next, cur->off = 0) {
+    while (cur->off < chunk->used) {
+      obj = (cobj_t)((char *)chunk + COBJ_ARENA_HDR + cur->off);
+
+      /*
+			 * Padding reads as an object without a table.
+			 */
+      if ((ops = COBJ_OPS(obj)) == NULL) {
+        cur->off += __alignof__(struct cobj);
+        continue;
+      }
+
+      cur->chunk = chunk;
+      cur->off += ops->cls->size;
+      return (obj);
+    }
+  }
+
+  cur->chunk = NULL;
+  cur->off = 1;
+
+  return (NULL);
+}
+
+/*
+ * Release every object in the arena. The references on their
+ * classes are dropped, freeing the ops tables of classes which
+ * have no other instances, and all chunks but the most recent
+ * one of the default size are returned to the system; chunks
+ * of single large objects are never kept.
+ */
+void cobj_arena_reset(cobj_arena_t arena) {
+  struct cobj_arena_chunk *chunk, *keep;
+  cobj_class_t cls;
+
+  if (arena == NULL)
+    return;
+
+  while (arena->nclasses > 0) {
+    cls = arena->classes[--arena->nclasses].cls;
+
+    if (cobj_class_unref(cls))
+      (void)cobj_class_free(cls);
+  }
+
+  keep = NULL;
+
+  while ((chunk = arena->chunks) != NULL) {
+    arena->chunks = chunk->next;
+
+    if (keep == NULL && chunk->size == arena->chunksize)
+      keep = chunk;
+    else
+      free(chunk);
+  }
+
+  if (keep != NULL) {
+    keep->next = NULL;
+    keep->used = 0;
+    arena->chunks = keep;
+  }
+}
+
+void cobj_arena_destroy(cobj_arena_t arena) {
+
+  if (arena == NULL)
+    return;
+
+  cobj_arena_reset(arena);
+
+  free(arena->chunks);
+  free(arena->classes);
+  free(arena);
+}
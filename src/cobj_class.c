@@ -51,138 +51,1166 @@
 #include <sys/cdefs.h>
 #include <sys/types.h>
 
+#include <err.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
 
 #include <libcobj.h>
 
-static int cobj_next_id = 1;
+#include "cobj_private.h"
+
+/*
+ * Generations of tables compiled at run time are odd, those of
+ * tables precompiled by makeobjops.awk are their address.
+ */
+static u_long cobj_next_gen = 1;
+
+/*
+ * Reference count shard of the calling thread, 0 if
+ * none has been assigned yet.
+ */
+static __thread u_int cobj_ref_slot;
+static u_int cobj_ref_next;
+
+/*
+ * Number of multipliers tried before a flat
+ * class falls back to an ordinary cache.
+ */
+#define COBJ_FLAT_TRIES 1024
+
+/*
+ * Maximum number of classes in a hierarchy
+ * which gets a precomputed resolution order.
+ */
+#define COBJ_MRO_MAX 32
+
+static struct cobj_isa *cobj_class_ancestry(cobj_class_t cls);
+static cobj_method_t *cobj_call_method_at_class(cobj_class_t cls,
+                                                cobjop_desc_t desc);
+static cobj_method_t *cobj_call_method_at_mi(cobj_class_t cls,
+                                             cobjop_desc_t desc);
 
 /*
  * This method structure is used to initialise new caches. Since the
  * desc pointer is NULL, it is guaranteed never to match any read
  * descriptors.
  */
-static const struct cobj_method null_method = {
+const struct cobj_method cobj_null_method = {
     NULL,
     NULL,
 };
 
 /*
- * Initialize a class.
+ * Linearize the class hierarchy. The resolution order is the
+ * depth-first, left-to-right order in which cobj_call_method_at_mi
+ * visits the classes, with every class kept at its first position
+ * only, so looking a method up along it finds the same one.
+ */
+
+static int
+cobj_class_linearize(cobj_class_t cls, cobj_class_t *mro, int n) {
+  cobj_class_t *basep;
+  int i;
+
+  for (i = 0; i < n; i++) {
+    if (mro[i] == cls)
+      return (n);
+  }
+
+  if (n == COBJ_MRO_MAX)
+    return (-1);
+
+  mro[n++] = cls;
+
+  if ((basep = cls->baseclasses) != NULL) {
+    for (; *basep; basep++) {
+      if ((n = cobj_class_linearize(*basep, mro, n)) < 0)
+        return (-1);
+    }
+  }
+
+  return (n);
+}
+
+/*
+ * Layout of an ops table, worked out before
+ * the space for it is allocated.
+ */
+struct cobj_plan {
+  u_int flags;  /* COBJ_OPS_* */
+  u_int mult;   /* slot hash multiplier */
+  u_int shift;  /* slot hash shift */
+  int nmro;     /* classes in resolution order, -1 if too many */
+  int n;        /* reachable methods, -1 if too many */
+  u_int nsuper; /* slots for overridden methods */
+  cobj_class_t mro[COBJ_MRO_MAX];
+  cobj_method_t *index[COBJ_CACHE_SIZE];
+  cobj_class_t owner[COBJ_CACHE_SIZE];
+  u_int id[COBJ_CACHE_SIZE];  /* descriptor IDs the slots follow */
+};
+
+#define COBJ_PLAN_SLOTS(plan) (1U << (32 - (plan)->shift))
+
+/*
+ * Resolve the methods reachable through the class. The
+ * first class in the resolution order implementing a method
+ * wins, the same as a lookup along it.
  */
 
 static void
-cobj_class_compile_common(cobj_class_t cls, cobj_ops_t ops) {
+cobj_class_resolve(cobj_class_t cls, struct cobj_plan *plan) {
   cobj_method_t *m;
-  int i;
+  int i, j;
+
+  plan->n = 0;
+  plan->nsuper = 0;
+
+  if ((plan->nmro = cobj_class_linearize(cls, plan->mro, 0)) < 0) {
+    plan->n = -1;
+    return;
+  }
+
+  for (i = 0; i < plan->nmro; i++) {
+    for (m = plan->mro[i]->methods; m->desc; m++) {
+      /*
+       * With base classes, every implementation may
+       * call the next one, see cobj_class_super().
+       */
+      if (plan->nmro > 1)
+        plan->nsuper++;
+
+      for (j = 0; j < plan->n; j++) {
+        if (plan->index[j]->desc == m->desc)
+          break;
+      }
+
+      if (j < plan->n)
+        continue;
+
+      if (plan->n == COBJ_CACHE_SIZE) {
+        plan->n = -1;
+        return;
+      }
+
+      plan->owner[plan->n] = plan->mro[i];
+      plan->index[plan->n++] = m;
+    }
+  }
+
+  if (plan->nsuper != 0) {
+    for (i = 1; (u_int)i < 2 * plan->nsuper; i <<= 1)
+      ;
+    plan->nsuper = i;
+  }
+}
+
+/*
+ * Descriptor IDs.
+ *
+ * A method lands in the slot given by the low bits of its ID, in
+ * a table of at most COBJ_CACHE_SIZE slots. IDs are therefore
+ * handed out by residue modulo COBJ_CACHE_SIZE: when a class is
+ * compiled, its unregistered methods are given residues which no
+ * other method reachable through the class occupies in a table of
+ * the size the class gets. IDs of methods no compiled table uses
+ * any more are put back and handed out again. IDs are only a hint
+ * for the cache, lookups never depend on them.
+ *
+ * A compile holds cobj_id_rwlock for reading from registering the
+ * methods of the class until its table holds them, so that an ID
+ * is never put back while a table is being laid out after it.
+ */
+
+#define COBJ_ID_STATIC 0x80000000U  /* assigned by makeobjops.awk -s */
+
+static u_int cobj_id_next[COBJ_CACHE_SIZE];  /* IDs handed out, by residue */
+static u_int cobj_id_cursor;                 /* where the next search starts */
+
+/*
+ * Released IDs, by residue.
+ */
+struct cobj_id_pool {
+  u_int *ids;
+  u_int n;
+  u_int size;
+};
+
+static pthread_rwlock_t cobj_id_rwlock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_mutex_t cobj_id_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct cobj_id_pool cobj_id_free[COBJ_CACHE_SIZE];
+static u_int cobj_id_nfree;
+
+static u_int
+cobj_id_alloc(u_int r) {
+  struct cobj_id_pool *p;
+  u_int id;
+
+  id = 0;
+
+  if (__atomic_load_n(&cobj_id_nfree, __ATOMIC_RELAXED) != 0) {
+    pthread_mutex_lock(&cobj_id_lock);
+    p = &cobj_id_free[r];
+    if (p->n > 0) {
+      id = p->ids[p->n - 1];
+      __atomic_store_n(&p->n, p->n - 1, __ATOMIC_RELAXED);
+      __atomic_store_n(&cobj_id_nfree, cobj_id_nfree - 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&cobj_id_lock);
+  }
+
+  if (id == 0)
+    id = (__atomic_add_fetch(&cobj_id_next[r], 1, __ATOMIC_RELAXED) *
+          COBJ_CACHE_SIZE) + r;
+
+  return (id);
+}
+
+static void
+cobj_id_put(u_int id) {
+  struct cobj_id_pool *p;
+  u_int *ids;
+
+  pthread_mutex_lock(&cobj_id_lock);
+  p = &cobj_id_free[id % COBJ_CACHE_SIZE];
+  if (p->n == p->size) {
+    ids = realloc(p->ids, (p->size ? 2 * p->size : 8) * sizeof(u_int));
+    if (ids != NULL) {
+      p->ids = ids;
+      p->size = p->size ? 2 * p->size : 8;
+    }
+  }
+  if (p->n < p->size) {
+    p->ids[p->n] = id;
+    __atomic_store_n(&p->n, p->n + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&cobj_id_nfree, cobj_id_nfree + 1, __ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&cobj_id_lock);
+}
+
+/*
+ * Give a descriptor an ID with residue r. A descriptor shared
+ * by two classes compiled at the same time keeps whichever ID
+ * landed first.
+ */
+
+static void
+cobj_id_assign(cobjop_desc_t desc, u_int r) {
+  u_int id, zero;
+
+  id = cobj_id_alloc(r);
+  zero = 0;
+
+  if (!__atomic_compare_exchange_n(&desc->id, &zero, id, 0,
+                                   __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    cobj_id_put(id);
+}
+
+/*
+ * Number of slots an ordinary table for n methods gets.
+ */
+
+static u_int
+cobj_plan_slots(int n) {
+  u_int slots;
+
+  for (slots = COBJ_CACHE_MIN; n < 0 || slots < 2 * (u_int)n; slots <<= 1) {
+    if (slots == COBJ_CACHE_SIZE)
+      break;
+  }
+
+  return (slots);
+}
+
+/*
+ * Register the methods of a class and its base classes one
+ * by one, for hierarchies too large to be resolved.
+ */
+
+static void
+cobj_class_register_all(cobj_class_t cls) {
+  cobj_method_t *m;
+  cobj_class_t *basep;
+  u_int r;
+
+  for (m = cls->methods; m->desc; m++) {
+    if (__atomic_load_n(&m->desc->id, __ATOMIC_RELAXED) == 0) {
+      r = __atomic_fetch_add(&cobj_id_cursor, 1, __ATOMIC_RELAXED);
+      cobj_id_assign(m->desc, r % COBJ_CACHE_SIZE);
+    }
+  }
+
+  if ((basep = cls->baseclasses) != NULL) {
+    for (; *basep; basep++)
+      cobj_class_register_all(*basep);
+  }
+}
+
+/*
+ * Register the unregistered methods reachable through the class,
+ * each in a slot which none of the others occupies. The search
+ * starts at a cursor which moves on with every class, so that the
+ * classes spread over the residues of the larger tables.
+ *
+ * Unless assign is set nothing is registered, the plan gets the
+ * IDs the methods would be given, as far as the slots go.
+ */
+
+static void
+cobj_class_register(cobj_class_t cls, struct cobj_plan *plan, int assign) {
+  u_char used[COBJ_CACHE_SIZE];
+  cobjop_desc_t desc;
+  u_int slots, id, r, start;
+  int i, j;
+
+  if (plan->n < 0) {
+    if (assign)
+      cobj_class_register_all(cls);
+    return;
+  }
+
+  slots = cobj_plan_slots(plan->n);
+  memset(used, 0, sizeof(used));
+
+  for (i = 0; i < plan->n; i++) {
+    id = __atomic_load_n(&plan->index[i]->desc->id, __ATOMIC_RELAXED);
+    if (id != 0)
+      used[id & (slots - 1)] = 1;
+    plan->id[i] = id;
+  }
+
+  if (assign)
+    start = __atomic_fetch_add(&cobj_id_cursor, plan->n, __ATOMIC_RELAXED);
+  else
+    start = __atomic_load_n(&cobj_id_cursor, __ATOMIC_RELAXED);
+
+  for (i = 0; i < plan->n; i++) {
+    desc = plan->index[i]->desc;
+    if (plan->id[i] != 0)
+      continue;
+
+    /*
+		 * Prefer a residue for which a released ID is around.
+		 */
+    j = COBJ_CACHE_SIZE;
+    if (__atomic_load_n(&cobj_id_nfree, __ATOMIC_RELAXED) != 0) {
+      for (j = 0; j < COBJ_CACHE_SIZE; j++) {
+        r = (start + j) % COBJ_CACHE_SIZE;
+        if (!used[r & (slots - 1)] &&
+            __atomic_load_n(&cobj_id_free[r].n, __ATOMIC_RELAXED) != 0)
+          break;
+      }
+    }
+
+    if (j == COBJ_CACHE_SIZE) {
+      for (j = 0; j < COBJ_CACHE_SIZE; j++) {
+        r = (start + j) % COBJ_CACHE_SIZE;
+        if (!used[r & (slots - 1)])
+          break;
+      }
+    }
+    if (j == COBJ_CACHE_SIZE)
+      r = start % COBJ_CACHE_SIZE;
+
+    used[r & (slots - 1)] = 1;
+    start = r + 1;
+
+    if (!assign) {
+      plan->id[i] =
+          (__atomic_load_n(&cobj_id_next[r], __ATOMIC_RELAXED) + 1) *
+              COBJ_CACHE_SIZE + r;
+      continue;
+    }
+
+    cobj_id_assign(desc, r);
+    plan->id[i] = __atomic_load_n(&desc->id, __ATOMIC_RELAXED);
+  }
+}
+
+/*
+ * The methods of a table are in use by it for as long as it
+ * exists, see cobj_ops_release().
+ */
+
+static void
+cobj_ops_hold(cobj_ops_t ops) {
+  u_int i;
+
+  for (i = 0; i < ops->nindex; i++)
+    __atomic_add_fetch(&ops->index[i]->desc->refs, 1, __ATOMIC_RELAXED);
+}
+
+void cobj_ops_release(cobj_ops_t ops) {
+  cobjop_desc_t desc;
+  u_int i, id;
+
+  for (i = 0; i < ops->nindex; i++) {
+    desc = ops->index[i]->desc;
+
+    if (__atomic_sub_fetch(&desc->refs, 1, __ATOMIC_RELAXED) != 0)
+      continue;
+
+    id = __atomic_load_n(&desc->id, __ATOMIC_RELAXED);
+    if (id == 0 || (id & COBJ_ID_STATIC) != 0)
+      continue;
+
+    /*
+		 * Wait for the compiles which may have read the ID,
+		 * their tables hold the method again once they are
+		 * done.
+		 */
+    pthread_rwlock_wrlock(&cobj_id_rwlock);
+    if (__atomic_load_n(&desc->refs, __ATOMIC_RELAXED) == 0 &&
+        __atomic_compare_exchange_n(&desc->id, &id, 0, 0,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      cobj_id_put(id);
+    pthread_rwlock_unlock(&cobj_id_rwlock);
+  }
+}
+
+static int
+cobj_method_cmp(const void *a, const void *b) {
+  uintptr_t da, db;
+
+  da = (uintptr_t)(*(cobj_method_t *const *)a)->desc;
+  db = (uintptr_t)(*(cobj_method_t *const *)b)->desc;
+
+  return ((da > db) - (da < db));
+}
+
+/*
+ * Search for a multiplier under which all reachable methods
+ * get their own slot in a table of the given size.
+ */
+
+static int
+cobj_class_flatten(struct cobj_plan *plan, u_int shift) {
+  u_char used[COBJ_CACHE_SIZE];
+  u_int mult, slot;
+  int i, try;
+
+  mult = 0x9e3779b1;
+
+  for (try = 0; try < COBJ_FLAT_TRIES; try++) {
+    memset(used, 0, sizeof(used));
+
+    for (i = 0; i < plan->n; i++) {
+      slot = (plan->id[i] * mult) >> shift;
+      if (used[slot])
+        break;
+      used[slot] = 1;
+    }
+
+    if (i == plan->n) {
+      plan->flags |= COBJ_OPS_FLAT;
+      plan->mult = mult;
+      plan->shift = shift;
+      return (0);
+    }
+
+    mult = (mult * 1664525 + 1013904223) | 1;
+  }
+
+  return (-1);
+}
+
+/*
+ * Size the table after the number of methods reachable through
+ * the class, leaving room for the defaults of methods it does not
+ * implement. A flat class gets the smallest table for which a
+ * collision-free hash is found, else it is left as an ordinary
+ * cache. The methods are registered if assign is set, see
+ * cobj_class_register().
+ */
+
+static void
+cobj_class_plan(cobj_class_t cls, struct cobj_plan *plan, u_int maxslots,
+                int assign) {
+  u_int slots;
+  int flat;
+
+  flat = (cls->flags & COBJ_CLASS_FLAT) != 0;
+
+  cobj_class_resolve(cls, plan);
+  cobj_class_register(cls, plan, assign);
+
+  plan->flags = 0;
+
+  if (flat && plan->n >= 0) {
+    for (slots = COBJ_CACHE_MIN; slots < (u_int)plan->n; slots <<= 1)
+      ;
+
+    for (; slots <= maxslots; slots <<= 1) {
+      if (cobj_class_flatten(plan, 32 - (ffs(slots) - 1)) == 0)
+        return;
+    }
+  }
+
+  slots = cobj_plan_slots(plan->n);
+
+  if (slots > maxslots)
+    slots = maxslots;
+
+  plan->shift = 32 - (ffs(slots) - 1);
+  plan->mult = 1U << plan->shift;
+}
+
+/*
+ * Fill the table of overridden methods. Every class in the
+ * resolution order gets an entry for each method it implements,
+ * holding the implementation of the first class after it which
+ * implements the method too, or the default.
+ */
+
+static void
+cobj_class_super(cobj_ops_t ops) {
+  struct cobj_super *sp;
+  cobj_method_t *m, *ce;
+  u_int i, j, slot;
+
+  memset(ops->super, 0, ops->nsuper * sizeof(struct cobj_super));
+
+  for (i = 0; i < ops->nmro; i++) {
+    for (m = ops->mro[i]->methods; m->desc; m++) {
+      ce = NULL;
+      for (j = i + 1; j < ops->nmro && ce == NULL; j++)
+        ce = cobj_call_method_at_class(ops->mro[j], m->desc);
+
+      if (ce == NULL)
+        ce = &m->desc->deflt;
+
+      slot = COBJ_SUPER_SLOT(ops, ops->mro[i], m->desc->id);
+      for (;; slot = (slot + 1) & (ops->nsuper - 1)) {
+        sp = &ops->super[slot];
+        if (sp->cls == NULL ||
+            (sp->cls == ops->mro[i] && sp->ce->desc == m->desc))
+          break;
+      }
+
+      if (sp->cls == NULL) {
+        sp->cls = ops->mro[i];
+        sp->ce = ce;
+      }
+    }
+  }
+}
+
+/*
+ * Space needed for the table, and for the index and resolution
+ * order kept behind it.
+ */
+
+static size_t
+cobj_plan_size(struct cobj_plan *plan, int withindex) {
+  size_t size;
+
+  size = COBJ_OPS_SIZE(COBJ_PLAN_SLOTS(plan));
+
+  if (withindex && plan->n >= 0)
+    size += plan->n * sizeof(cobj_method_t *) +
+            plan->nmro * sizeof(cobj_class_t) +
+            plan->nsuper * sizeof(struct cobj_super);
+
+  return (size);
+}
+
+/*
+ * Size of a table allocated by cobj_class_compile(3).
+ */
+
+static size_t
+cobj_ops_size(cobj_ops_t ops) {
+  size_t size;
+
+  size = COBJ_OPS_SIZE(1U << (32 - ops->shift));
+
+  if (ops->index != NULL)
+    size += ops->nindex * sizeof(cobj_method_t *) +
+            ops->nmro * sizeof(cobj_class_t) +
+            ops->nsuper * sizeof(struct cobj_super);
+
+  return (size);
+}
+
+/*
+ * Initialize a class.
+ */
+
+static int
+cobj_class_compile_common(cobj_class_t cls, cobj_ops_t ops,
+                          struct cobj_plan *plan, int withindex) {
+  cobj_method_t *ce;
+  cobj_ops_t prev;
+  u_int i;
 
   /*
 	 * Don't do anything if we are already compiled.
 	 */
-  if (cls->ops != NULL)
-    return;
+  if (__atomic_load_n(&cls->ops, __ATOMIC_ACQUIRE) != NULL)
+    return (-1);
 
   /*
-	 * First register any methods which need it.
+	 * Initialise the ops table.
 	 */
-  for (m = cls->methods; m->desc; m++) {
-    if (m->desc->id == 0)
-      m->desc->id = cobj_next_id++;
+  for (i = 0; i < COBJ_PLAN_SLOTS(plan); i++)
+    ops->cache[i] = &cobj_null_method;
+
+  ops->cls = cls;
+  ops->flags = plan->flags;
+  ops->shift = plan->shift;
+  ops->mult = plan->mult;
+  ops->nindex = 0;
+  ops->nmro = 0;
+  ops->nsuper = 0;
+  ops->gen = __atomic_fetch_add(&cobj_next_gen, 2, __ATOMIC_RELAXED);
+  ops->index = NULL;
+  ops->mro = NULL;
+  ops->super = NULL;
+
+  /*
+	 * Keep the resolved methods sorted by descriptor, so that
+	 * a cache miss is a binary search, and the resolution
+	 * order of the class.
+	 */
+  if (withindex && plan->n >= 0) {
+    ops->index = (cobj_method_t **)&ops->cache[COBJ_PLAN_SLOTS(plan)];
+    ops->nindex = plan->n;
+    memcpy(ops->index, plan->index, plan->n * sizeof(cobj_method_t *));
+    qsort(ops->index, plan->n, sizeof(cobj_method_t *), cobj_method_cmp);
+
+    ops->mro = (cobj_class_t *)&ops->index[plan->n];
+    ops->nmro = plan->nmro;
+    memcpy(ops->mro, plan->mro, plan->nmro * sizeof(cobj_class_t));
+
+    if (plan->nsuper != 0) {
+      ops->super = (struct cobj_super *)&ops->mro[plan->nmro];
+      ops->nsuper = plan->nsuper;
+      cobj_class_super(ops);
+    }
   }
 
   /*
-	 * Then initialise the ops table.
+	 * Resolve every reachable method of a flat class
+	 * up front.
 	 */
-  for (i = 0; i < COBJ_CACHE_SIZE; i++)
-    ops->cache[i] = &null_method;
+  if (ops->flags & COBJ_OPS_FLAT) {
+    for (i = 0; i < (u_int)plan->n; i++) {
+      ce = plan->index[i];
+      ops->cache[COBJ_OPS_SLOT(ops, plan->id[i])] = ce;
+    }
+  }
 
-  ops->cls = cls;
-  cls->ops = ops;
+  /*
+	 * Publish the table. We may have lost a race for
+	 * cobj_class_compile here, in which case the caller
+	 * keeps its table and the winner's stays in place.
+	 */
+  prev = NULL;
+  if (!__atomic_compare_exchange_n(&cls->ops, &prev, ops, 0,
+                                   __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+    return (-1);
+
+  cobj_ops_hold(ops);
+
+  return (0);
 }
 
 int cobj_class_compile(cobj_class_t cls) {
-  cobj_ops_t ops;
+  struct cobj_plan plan;
+  cobj_ops_t ops, prev;
+  size_t size;
 
   COBJ_ASSERT(MA_NOTOWNED);
 
   if (cls == NULL)
     return (-1);
 
+  if (__atomic_load_n(&cls->ops, __ATOMIC_ACQUIRE) != NULL)
+    return (0);
+
   /*
-	 * Allocate space for the compiled ops table.
+	 * Bring back the table of the last instance, if it
+	 * is still waiting to be reclaimed.
 	 */
-  if ((ops = calloc(1, sizeof(struct cobj_ops))) == NULL)
-    return (-1);
+  if ((ops = cobj_ops_reuse(cls)) != NULL) {
+    prev = NULL;
+    if (!__atomic_compare_exchange_n(&cls->ops, &prev, ops, 0,
+                                     __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+      cobj_ops_retire(ops, cobj_ops_size(ops));
+    return (0);
+  }
 
-  sem_wait(&cobj_lock);
+  /*
+	 * Work out the ancestry for cobj_isa(3) while we
+	 * are at it, it is kept with the class.
+	 */
+  (void)cobj_class_ancestry(cls);
+
+  pthread_rwlock_rdlock(&cobj_id_rwlock);
+
+  cobj_class_plan(cls, &plan, COBJ_CACHE_SIZE, 1);
 
   /*
-	 * We may have lost a race for cobj_class_compile here - check
-	 * to make sure someone else hasn't already compiled this
-	 * class.
+	 * Allocate space for the compiled ops table.
 	 */
-  if (cls->ops != NULL) {
-    sem_post(&cobj_lock);
-    free(ops);
-  } else {
-    cobj_class_compile_common(cls, ops);
-    sem_post(&cobj_lock);
+  size = cobj_plan_size(&plan, 1);
+
+  if ((ops = cobj_allocator->alloc(cobj_allocator, size)) == NULL) {
+    pthread_rwlock_unlock(&cobj_id_rwlock);
+    return (-1);
   }
 
+  if (cobj_class_compile_common(cls, ops, &plan, 1) != 0)
+    cobj_allocator->free(cobj_allocator, ops, size);
+  else
+    __atomic_fetch_add(&cobj_ops_counters.compiled, 1, __ATOMIC_RELAXED);
+
+  pthread_rwlock_unlock(&cobj_id_rwlock);
+
   return (0);
 }
 
-int cobj_class_compile_static(cobj_class_t cls, cobj_ops_t ops) {
+int cobj_class_compile_flags(cobj_class_t cls, u_int flags) {
+
+  if (cls == NULL)
+    return (-1);
+
+  __atomic_or_fetch(&cls->flags, flags, __ATOMIC_RELAXED);
+
+  return (cobj_class_compile(cls));
+}
+
+int cobj_class_compile_static(cobj_class_t cls, cobj_ops_t ops,
+                              size_t size) {
+  struct cobj_plan plan;
+  u_int maxslots;
 
   if (ops == NULL)
     return (-1);
 
   if (cls == NULL)
     return (-1);
+
+  /*
+	 * The table is sized to fit into the space
+	 * provided by the caller.
+	 */
+  if (size < COBJ_OPS_SIZE(COBJ_CACHE_MIN))
+    return (-1);
+
+  for (maxslots = COBJ_CACHE_SIZE; COBJ_OPS_SIZE(maxslots) > size;)
+    maxslots >>= 1;
+
+  pthread_rwlock_rdlock(&cobj_id_rwlock);
+
+  cobj_class_plan(cls, &plan, maxslots, 1);
+
   /*
 	 * Increment refs to make sure that
 	 * the ops table is not freed.
 	 */
 
-  cls->refs++;
-  cobj_class_compile_common(cls, ops);
+  cobj_class_ref(cls, 0);
+  (void)cobj_class_compile_common(cls, ops, &plan,
+                                  cobj_plan_size(&plan, 1) <= size);
+
+  pthread_rwlock_unlock(&cobj_id_rwlock);
 
   return (0);
 }
 
+/*
+ * Check whether base is the class itself or one of its ancestors.
+ */
+
+static int
+cobj_class_derives(cobj_class_t cls, cobj_class_t base) {
+  cobj_class_t *basep;
+
+  if (cls == base)
+    return (1);
+
+  if ((basep = cls->baseclasses) != NULL) {
+    for (; *basep; basep++) {
+      if (cobj_class_derives(*basep, base))
+        return (1);
+    }
+  }
+
+  return (0);
+}
+
+/*
+ * Ancestry of a class, see struct cobj_isa. The ancestry of the
+ * base classes is computed first, so that every class in the bit
+ * set already has its ID. Racing threads may both compute it, the
+ * one which loses frees its copy.
+ */
+
+static u_int cobj_isa_next_id;
+
+static void
+cobj_isa_set(struct cobj_isa *isa, struct cobj_isa *bisa) {
+  u_int i, id;
+
+  for (i = 0; i <= bisa->depth; i++) {
+    id = bisa->display[i]->isa->id;
+    isa->mi[id / COBJ_ISA_BITS] |= 1UL << (id % COBJ_ISA_BITS);
+  }
+
+  for (i = 0; i < bisa->nwords; i++)
+    isa->mi[i] |= bisa->mi[i];
+}
+
+static struct cobj_isa *
+cobj_class_ancestry(cobj_class_t cls) {
+  struct cobj_isa *isa, *bisa, *pisa, *prev;
+  cobj_class_t *basep;
+  u_int depth, nwords, i;
+  size_t size;
+
+  if ((isa = __atomic_load_n(&cls->isa, __ATOMIC_ACQUIRE)) != NULL)
+    return (isa);
+
+  pisa = NULL;
+  depth = 0;
+  nwords = 0;
+
+  if ((basep = cls->baseclasses) != NULL) {
+    for (i = 0; basep[i] != NULL; i++) {
+      if ((bisa = cobj_class_ancestry(basep[i])) == NULL)
+        return (NULL);
+
+      if (i == 0) {
+        pisa = bisa;
+        depth = bisa->depth + 1;
+        if (nwords < bisa->nwords)
+          nwords = bisa->nwords;
+      } else {
+        /*
+         * Ancestors get their IDs before the classes
+         * deriving from them, base has the largest.
+         */
+        if (nwords < bisa->nwords)
+          nwords = bisa->nwords;
+        if (nwords * COBJ_ISA_BITS <= bisa->id)
+          nwords = bisa->id / COBJ_ISA_BITS + 1;
+      }
+    }
+  }
+
+  size = sizeof(*isa) + (depth + 1) * sizeof(cobj_class_t) +
+         nwords * sizeof(u_long);
+
+  if ((isa = cobj_allocator->alloc(cobj_allocator, size)) == NULL)
+    return (NULL);
+
+  memset(isa, 0, size);
+  isa->mi = (u_long *)&isa[1];
+  isa->display = (cobj_class_t *)&isa->mi[nwords];
+  isa->depth = depth;
+  isa->nwords = nwords;
+  isa->id = __atomic_fetch_add(&cobj_isa_next_id, 1, __ATOMIC_RELAXED);
+
+  if (pisa != NULL) {
+    memcpy(isa->display, pisa->display, depth * sizeof(cobj_class_t));
+    memcpy(isa->mi, pisa->mi, pisa->nwords * sizeof(u_long));
+
+    for (i = 1; basep[i] != NULL; i++)
+      cobj_isa_set(isa, basep[i]->isa);
+  }
+
+  isa->display[depth] = cls;
+
+  prev = NULL;
+  if (!__atomic_compare_exchange_n(&cls->isa, &prev, isa, 0,
+                                   __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+    cobj_allocator->free(cobj_allocator, isa, size);
+    isa = prev;
+  }
+
+  return (isa);
+}
+
+int cobj_class_isa(cobj_class_t cls, cobj_class_t base) {
+  struct cobj_isa *isa, *bisa;
+
+  if (cls == NULL || base == NULL)
+    return (0);
+
+  if ((isa = cobj_class_ancestry(cls)) == NULL ||
+      (bisa = cobj_class_ancestry(base)) == NULL)
+    return (cobj_class_derives(cls, base));
+
+  return (COBJ_ISA_TEST(isa, bisa, base));
+}
+
+/*
+ * Name of a method in diagnostics, descriptors which were not
+ * generated by makeobjops.awk may have none.
+ */
+#define COBJ_DESC_NAME(desc) \
+  ((desc)->name != NULL ? (desc)->name : "(unnamed)")
+
+/*
+ * A method is ambiguous if a class later in the resolution order
+ * implements it differently and the class it was resolved to does
+ * not derive from that one, i.e. does not override it.
+ */
+int cobj_class_check(cobj_class_t cls) {
+  struct cobj_plan plan;
+  cobj_method_t *ce, *m;
+  int i, j, n;
+
+  if (cls == NULL)
+    return (-1);
+
+  cobj_class_resolve(cls, &plan);
+
+  if (plan.n < 0)
+    return (-1);
+
+  n = 0;
+
+  for (i = 0; i < plan.n; i++) {
+    ce = plan.index[i];
+
+    for (j = 0; j < plan.nmro; j++) {
+      if (cobj_class_derives(plan.owner[i], plan.mro[j]))
+        continue;
+
+      if ((m = cobj_call_method_at_class(plan.mro[j], ce->desc)) == NULL)
+        continue;
+
+      if (m->func == ce->func)
+        continue;
+
+      warnx("%s: method %s is implemented by both %s and %s, using %s",
+            cls->name, COBJ_DESC_NAME(ce->desc), plan.owner[i]->name,
+            plan.mro[j]->name, plan.owner[i]->name);
+      n++;
+    }
+  }
+
+  return (n);
+}
+
+/*
+ * Map the methods reachable through the class to slots the way
+ * its compiled table does, or would if it is not compiled yet;
+ * methods without an ID are not registered for that.
+ */
+int cobj_class_slots(cobj_class_t cls, struct cobj_slot_stats *st) {
+  struct cobj_plan plan;
+  int first[COBJ_CACHE_SIZE];
+  cobj_ops_t ops;
+  u_int mult, shift, slots, slot, used;
+  int i, n;
+
+  if (cls == NULL)
+    return (-1);
+
+  if ((ops = __atomic_load_n(&cls->ops, __ATOMIC_ACQUIRE)) != NULL) {
+    cobj_class_resolve(cls, &plan);
+    for (i = 0; i < plan.n; i++)
+      plan.id[i] = __atomic_load_n(&plan.index[i]->desc->id, __ATOMIC_RELAXED);
+    mult = ops->mult;
+    shift = ops->shift;
+  } else {
+    cobj_class_plan(cls, &plan, COBJ_CACHE_SIZE, 0);
+    mult = plan.mult;
+    shift = plan.shift;
+  }
+
+  if (plan.n < 0)
+    return (-1);
+
+  slots = 1U << (32 - shift);
+  for (slot = 0; slot < slots; slot++)
+    first[slot] = -1;
+
+  used = 0;
+  n = 0;
+
+  for (i = 0; i < plan.n; i++) {
+    slot = (plan.id[i] * mult) >> shift;
+
+    if (first[slot] < 0) {
+      first[slot] = i;
+      used++;
+      continue;
+    }
+
+    warnx("%s: method %s shares slot %u with method %s", cls->name,
+          COBJ_DESC_NAME(plan.index[i]->desc), slot,
+          COBJ_DESC_NAME(plan.index[first[slot]]->desc));
+    n++;
+  }
+
+  if (st != NULL) {
+    st->slots = slots;
+    st->methods = plan.n;
+    st->used = used;
+    st->collisions = n;
+  }
+
+  return (n);
+}
+
+/*
+ * Reference counting.
+ */
+
+static u_long *
+cobj_class_refp(cobj_class_t cls, int canalloc) {
+  struct cobj_refs *rs, *prev;
+
+  if ((rs = __atomic_load_n(&cls->refshards, __ATOMIC_ACQUIRE)) == NULL) {
+    /*
+		 * Until the shards exist, or if we may not call
+		 * calloc(3), count in the class itself.
+		 */
+    if (!canalloc || (rs = calloc(1, sizeof(*rs))) == NULL)
+      return (&cls->refs);
+
+    prev = NULL;
+    if (!__atomic_compare_exchange_n(&cls->refshards, &prev, rs, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      free(rs);
+      rs = prev;
+    }
+  }
+
+  if (cobj_ref_slot == 0)
+    cobj_ref_slot = __atomic_fetch_add(&cobj_ref_next, 1,
+                                       __ATOMIC_RELAXED) % COBJ_REF_SHARDS + 1;
+
+  return (&rs->shard[cobj_ref_slot - 1].count);
+}
+
+/*
+ * Add n to a shard, keeping count of the shards below zero.
+ * Returns the new count of the shard.
+ */
+static u_long
+cobj_class_add(cobj_class_t cls, u_long *refp, long n) {
+  struct cobj_refs *rs;
+  long count;
+
+  count = (long)__atomic_add_fetch(refp, n, __ATOMIC_SEQ_CST);
+
+  if ((count == -1 && n < 0) || (count == 0 && n > 0)) {
+    if ((rs = __atomic_load_n(&cls->refshards, __ATOMIC_ACQUIRE)) != NULL)
+      __atomic_add_fetch(&rs->negative, (n < 0) ? 1 : -1, __ATOMIC_SEQ_CST);
+  }
+
+  return ((u_long)count);
+}
+
+u_long
+cobj_class_refs(cobj_class_t cls) {
+  struct cobj_refs *rs;
+  u_long refs;
+  int i;
+
+  refs = __atomic_load_n(&cls->refs, __ATOMIC_SEQ_CST);
+
+  if ((rs = __atomic_load_n(&cls->refshards, __ATOMIC_ACQUIRE)) != NULL) {
+    for (i = 0; i < COBJ_REF_SHARDS; i++)
+      refs += __atomic_load_n(&rs->shard[i].count, __ATOMIC_SEQ_CST);
+  }
+
+  return (refs);
+}
+
+/*
+ * Take a reference on the class. If cobj_class_free(3) is
+ * about to release the ops table, back off until it is done,
+ * so that we never pick up a table which is being freed.
+ */
+void cobj_class_ref(cobj_class_t cls, int canalloc) {
+  u_long *refp;
+
+  refp = cobj_class_refp(cls, canalloc);
+
+  for (;;) {
+    cobj_class_add(cls, refp, 1);
+
+    if (__atomic_load_n(&cls->busy, __ATOMIC_SEQ_CST) == 0)
+      break;
+
+    cobj_class_add(cls, refp, -1);
+
+    while (__atomic_load_n(&cls->busy, __ATOMIC_ACQUIRE) != 0)
+      sched_yield();
+  }
+}
+
+/*
+ * Drop a reference. While no shard is below zero, a shard
+ * still above it holds instances, otherwise the others may
+ * hold the last ones and we have to look at all of them. A
+ * shard going negative is counted before the sum is taken,
+ * so of two racing last deletes at least one sees it.
+ */
+int cobj_class_unref(cobj_class_t cls) {
+  struct cobj_refs *rs;
+  u_long *refp;
+
+  refp = cobj_class_refp(cls, 1);
+
+  if ((long)cobj_class_add(cls, refp, -1) > 0 &&
+      (rs = __atomic_load_n(&cls->refshards, __ATOMIC_ACQUIRE)) != NULL &&
+      __atomic_load_n(&rs->negative, __ATOMIC_SEQ_CST) == 0 &&
+      (long)__atomic_load_n(&cls->refs, __ATOMIC_SEQ_CST) >= 0)
+    return (0);
+
+  return (cobj_class_refs(cls) == 0);
+}
+
 /*
  * Release bound methods.
  */
 int cobj_class_free(cobj_class_t cls) {
-  void *ops = NULL;
+  cobj_ops_t ops = NULL;
+  u_int busy = 0;
 
   COBJ_ASSERT(MA_NOTOWNED);
 
   if (cls == NULL)
     return (-1);
 
-  sem_wait(&cobj_lock);
+  /*
+	 * Someone else is already releasing the table.
+	 */
+  if (!__atomic_compare_exchange_n(&cls->busy, &busy, 1, 0,
+                                   __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+    return (0);
 
   /*
 	 * Protect against a race between cobj_create and cobj_delete.
+	 * Since busy is set, cobj_init(3) either shows up in refs
+	 * here or waits until we are done.
 	 */
-  if (cls->refs == 0) {
+  if (cobj_class_refs(cls) == 0) {
     /*
-		 * For now we don't do anything to unregister any methods
-		 * which are no longer used.
+		 * Free memory and clean up. The IDs of methods no other
+		 * table uses are released along with the table.
 		 */
-
-    /*
-		 * Free memory and clean up.
-		 */
-    ops = cls->ops;
-    cls->ops = NULL;
+    ops = __atomic_exchange_n(&cls->ops, NULL, __ATOMIC_ACQ_REL);
   }
 
-  sem_post(&cobj_lock);
+  __atomic_store_n(&cls->busy, 0, __ATOMIC_RELEASE);
 
+  /*
+	 * Threads may still be dispatching through the table,
+	 * leave it to the epoch reclamation.
+	 */
   if (ops != NULL)
-    free(ops);
+    cobj_ops_retire(ops, cobj_ops_size(ops));
 
   return (0);
 }
@@ -226,21 +1254,127 @@ cobj_call_method_at_mi(cobj_class_t cls, cobjop_desc_t desc) {
   return (NULL);
 }
 
+/*
+ * Binary search of the resolved methods.
+ */
+
+static cobj_method_t *
+cobj_call_method_at_index(cobj_ops_t ops, cobjop_desc_t desc) {
+  cobj_method_t *ce;
+  u_int lo, hi, mid;
+
+  lo = 0;
+  hi = ops->nindex;
+
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    ce = ops->index[mid];
+
+    if (ce->desc == desc)
+      return (ce);
+
+    if ((uintptr_t)ce->desc < (uintptr_t)desc)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return (NULL);
+}
+
 cobj_method_t *
 cobj_call_method(cobj_class_t cls,
                  cobj_method_t **cep,
                  cobjop_desc_t desc) {
   cobj_method_t *ce;
+  cobj_ops_t ops;
+  u_long start;
+  int stats;
 
-  if ((ce = cobj_call_method_at_mi(cls, desc)) == NULL)
+  stats = __atomic_load_n(&cobj_stats_enabled, __ATOMIC_RELAXED);
+  start = stats ? cobj_stats_clock() : 0;
+
+  ops = __atomic_load_n(&cls->ops, __ATOMIC_ACQUIRE);
+
+  if (ops != NULL && ops->index != NULL)
+    ce = cobj_call_method_at_index(ops, desc);
+  else
+    ce = cobj_call_method_at_mi(cls, desc);
+
+  if (ce == NULL)
     ce = &desc->deflt;
 
-  if (cep != NULL)
-    *cep = ce;
+  if (stats)
+    cobj_stats_miss(cls, desc, ce == &desc->deflt,
+                    cobj_stats_clock() - start);
+
+  /*
+	 * The slots of a flat table belong to the methods which
+	 * were resolved at compile time, only unused ones may
+	 * cache anything else. Precompiled tables live in
+	 * read-only memory and are never written.
+	 */
+  if (cep != NULL && (ops == NULL || (ops->flags & COBJ_OPS_CONST) == 0)) {
+    if (*cep == &cobj_null_method || ops == NULL ||
+        (ops->flags & COBJ_OPS_FLAT) == 0)
+      *cep = ce;
+  }
 
   return (ce);
 }
 
+/*
+ * Look up the implementation following the one of cls in the
+ * resolution order of the class of the table. A table without
+ * the resolution order is linearized here; a hierarchy too deep
+ * for that only looks at the base classes of cls.
+ */
+cobj_method_t *
+cobj_call_super(cobj_ops_t ops, cobj_class_t cls, cobjop_desc_t desc) {
+  cobj_class_t mrobuf[COBJ_MRO_MAX], *mro, *basep;
+  struct cobj_super *sp;
+  cobj_method_t *ce;
+  u_int slot, n;
+  int nmro, i;
+
+  if (ops->nsuper != 0) {
+    slot = COBJ_SUPER_SLOT(ops, cls, desc->id);
+    for (n = 0; n < ops->nsuper; n++) {
+      sp = &ops->super[slot];
+      if (sp->cls == NULL)
+        break;
+      if (sp->cls == cls && sp->ce->desc == desc)
+        return (sp->ce);
+      slot = (slot + 1) & (ops->nsuper - 1);
+    }
+  }
+
+  if (ops->mro != NULL) {
+    mro = ops->mro;
+    nmro = ops->nmro;
+  } else {
+    mro = mrobuf;
+    nmro = cobj_class_linearize(ops->cls, mro, 0);
+  }
+
+  for (i = 0; i < nmro && mro[i] != cls; i++)
+    ;
+
+  if (i < nmro) {
+    for (i++; i < nmro; i++) {
+      if ((ce = cobj_call_method_at_class(mro[i], desc)) != NULL)
+        return (ce);
+    }
+  } else if (nmro < 0 && (basep = cls->baseclasses) != NULL) {
+    for (; *basep; basep++) {
+      if ((ce = cobj_call_method_at_mi(*basep, desc)) != NULL)
+        return (ce);
+    }
+  }
+
+  return (&desc->deflt);
+}
+
 int cobj_nop(void) {
 
   return (-1);
@@ -0,0 +1,311 @@
+/*-
+ * Copyright (c) 2019 Henning Matyschok
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <libcobj.h>
+
+#include "cobj_private.h"
+
+/*
+ * Epoch based reclamation of compiled method tables.
+ *
+ * A table whose class has lost its last instance is not freed
+ * right away. It is retired into a limbo list instead, tagged
+ * with the epoch it was retired in, and kept warm for the grace
+ * period, so that recreating an instance of the class reuses
+ * it instead of compiling a new one. It is only freed after the
+ * grace period has passed and no thread is still inside an epoch
+ * section it entered before the table was retired.
+ */
+
+#define COBJ_GRACE_MSEC 100  /* default grace period */
+
+/*
+ * Per-thread epoch record, zero while the thread is outside
+ * of an epoch section.
+ */
+struct cobj_epoch_rec {
+  struct cobj_thread_rec rec;
+  u_long epoch;                 /* epoch the section was entered in */
+} COBJ_ALIGNED;
+
+/*
+ * A retired table.
+ */
+struct cobj_limbo {
+  struct cobj_limbo *next;
+  cobj_ops_t ops;
+  size_t size;    /* bytes allocated for ops */
+  u_long epoch;   /* epoch it was retired in */
+  u_long when;    /* time it was retired, msec */
+};
+
+static void cobj_epoch_thread_exit(struct cobj_thread_rec *rec);
+
+static u_long cobj_epoch = 1;
+static struct cobj_thread_recs cobj_epoch_recs =
+    COBJ_THREAD_RECS(struct cobj_epoch_rec, cobj_epoch_thread_exit);
+static u_int cobj_grace = COBJ_GRACE_MSEC;
+
+/*
+ * The limbo list is changed only under cobj_limbo_lock, but its head is
+ * peeked at without the lock, so every store to a link uses
+ * __atomic_store_n.
+ */
+static pthread_mutex_t cobj_limbo_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct cobj_limbo *cobj_limbo;
+
+static __thread struct cobj_epoch_rec *cobj_epoch_self;
+static __thread u_int cobj_epoch_depth;
+
+struct cobj_ops_stats cobj_ops_counters;
+
+/*
+ * Leave the record of an exiting thread outside of any section.
+ */
+
+static void
+cobj_epoch_thread_exit(struct cobj_thread_rec *rec) {
+
+  __atomic_store_n(&((struct cobj_epoch_rec *)rec)->epoch, 0,
+                   __ATOMIC_RELEASE);
+}
+
+/*
+ * Enter and leave an epoch section. Sections nest.
+ */
+int cobj_epoch_enter(void) {
+  struct cobj_epoch_rec *rec;
+
+  if (cobj_epoch_depth++ > 0)
+    return (0);
+
+  if ((rec = cobj_epoch_self) == NULL &&
+      (rec = cobj_epoch_self = cobj_thread_rec(&cobj_epoch_recs)) == NULL) {
+    cobj_epoch_depth = 0;
+    return (-1);
+  }
+
+  __atomic_store_n(&rec->epoch, __atomic_load_n(&cobj_epoch, __ATOMIC_RELAXED),
+                   __ATOMIC_SEQ_CST);
+
+  return (0);
+}
+
+void cobj_epoch_exit(void) {
+
+  if (cobj_epoch_depth == 0 || --cobj_epoch_depth > 0)
+    return;
+
+  __atomic_store_n(&cobj_epoch_self->epoch, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Oldest epoch a thread is still inside of, or the current
+ * one if there is none.
+ */
+
+static u_long
+cobj_epoch_min(void) {
+  struct cobj_epoch_rec *rec;
+  u_long min, epoch;
+
+  min = __atomic_load_n(&cobj_epoch, __ATOMIC_SEQ_CST);
+
+  COBJ_THREAD_FOREACH(rec, &cobj_epoch_recs) {
+    epoch = __atomic_load_n(&rec->epoch, __ATOMIC_SEQ_CST);
+    if (epoch != 0 && epoch < min)
+      min = epoch;
+  }
+
+  return (min);
+}
+
+/*
+ * Wait for all threads to leave the sections they are in,
+ * which must not be called from inside one.
+ */
+void cobj_epoch_synchronize(void) {
+  u_long epoch;
+
+  epoch = __atomic_fetch_add(&cobj_epoch, 1, __ATOMIC_SEQ_CST);
+
+  while (cobj_epoch_min() <= epoch)
+    sched_yield();
+}
+
+static u_long
+cobj_msec(void) {
+  struct timespec ts;
+
+  (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ((u_long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+u_int cobj_set_grace(u_int msec) {
+
+  return (__atomic_exchange_n(&cobj_grace, msec, __ATOMIC_RELAXED));
+}
+
+/*
+ * Retire a table which has been unpublished from its class.
+ */
+void cobj_ops_retire(cobj_ops_t ops, size_t size) {
+  struct cobj_limbo *lp;
+
+  __atomic_fetch_add(&cobj_ops_counters.retired, 1, __ATOMIC_RELAXED);
+
+  if ((lp = malloc(sizeof(*lp))) == NULL) {
+    /*
+		 * Can't defer, so wait out the readers. Inside a
+		 * section of our own that would wait for ourselves,
+		 * the table is leaked instead.
+		 */
+    if (cobj_epoch_depth != 0)
+      return;
+
+    cobj_epoch_synchronize();
+    cobj_ops_release(ops);
+    cobj_allocator->free(cobj_allocator, ops, size);
+    __atomic_fetch_add(&cobj_ops_counters.freed, 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  lp->ops = ops;
+  lp->size = size;
+  lp->epoch = __atomic_fetch_add(&cobj_epoch, 1, __ATOMIC_SEQ_CST);
+  lp->when = cobj_msec();
+
+  pthread_mutex_lock(&cobj_limbo_lock);
+  lp->next = cobj_limbo;
+  __atomic_store_n(&cobj_limbo, lp, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&cobj_limbo_lock);
+
+  (void)cobj_ops_reclaim();
+}
+
+/*
+ * Take a retired table of the class back, if it was
+ * compiled in the mode the class asks for.
+ */
+cobj_ops_t
+cobj_ops_reuse(cobj_class_t cls) {
+  struct cobj_limbo *lp, **lpp;
+  cobj_ops_t ops;
+  u_int flat;
+
+  if (__atomic_load_n(&cobj_limbo, __ATOMIC_RELAXED) == NULL)
+    return (NULL);
+
+  flat = (__atomic_load_n(&cls->flags, __ATOMIC_RELAXED) & COBJ_CLASS_FLAT)
+             ? COBJ_OPS_FLAT
+             : 0;
+  ops = NULL;
+
+  pthread_mutex_lock(&cobj_limbo_lock);
+  for (lpp = &cobj_limbo; (lp = *lpp) != NULL; lpp = &lp->next) {
+    if (lp->ops->cls == cls && (lp->ops->flags & COBJ_OPS_FLAT) == flat) {
+      __atomic_store_n(lpp, lp->next, __ATOMIC_RELAXED);
+      ops = lp->ops;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&cobj_limbo_lock);
+
+  /*
+	 * Compiling a class is the other occasion to free what
+	 * has expired, besides retiring a table.
+	 */
+  if (ops == NULL) {
+    (void)cobj_ops_reclaim();
+    return (NULL);
+  }
+
+  free(lp);
+  __atomic_fetch_add(&cobj_ops_counters.reused, 1, __ATOMIC_RELAXED);
+
+  return (ops);
+}
+
+/*
+ * Free the retired tables whose grace period is over and
+ * which no thread can still be dispatching through.
+ */
+int cobj_ops_reclaim(void) {
+  struct cobj_limbo *lp, **lpp, *dead;
+  u_long min, now, grace;
+  int n;
+
+  if (__atomic_load_n(&cobj_limbo, __ATOMIC_RELAXED) == NULL)
+    return (0);
+
+  dead = NULL;
+  now = cobj_msec();
+  grace = __atomic_load_n(&cobj_grace, __ATOMIC_RELAXED);
+
+  pthread_mutex_lock(&cobj_limbo_lock);
+  min = cobj_epoch_min();
+
+  for (lpp = &cobj_limbo; (lp = *lpp) != NULL;) {
+    if (lp->epoch < min && now - lp->when >= grace) {
+      __atomic_store_n(lpp, lp->next, __ATOMIC_RELAXED);
+      lp->next = dead;
+      dead = lp;
+    } else
+      lpp = &lp->next;
+  }
+  pthread_mutex_unlock(&cobj_limbo_lock);
+
+  for (n = 0; (lp = dead) != NULL; n++) {
+    dead = lp->next;
+    cobj_ops_release(lp->ops);
+    cobj_allocator->free(cobj_allocator, lp->ops, lp->size);
+    free(lp);
+  }
+
+  __atomic_fetch_add(&cobj_ops_counters.freed, n, __ATOMIC_RELAXED);
+
+  return (n);
+}
+
+void cobj_ops_stats(struct cobj_ops_stats *st) {
+
+  if (st == NULL)
+    return;
+
+  st->compiled = __atomic_load_n(&cobj_ops_counters.compiled, __ATOMIC_RELAXED);
+  st->reused = __atomic_load_n(&cobj_ops_counters.reused, __ATOMIC_RELAXED);
+  st->retired = __atomic_load_n(&cobj_ops_counters.retired, __ATOMIC_RELAXED);
+  st->freed = __atomic_load_n(&cobj_ops_counters.freed, __ATOMIC_RELAXED);
+}
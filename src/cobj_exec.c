@@ -0,0 +1,673 @@
+/*-
+ * Copyright (c) 2019 Henning Matyschok
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libcobj.h>
+
+#include "cobj_exec_if.h"
+#include "cobj_private.h"
+
+/*
+ * Asynchronous calls.
+ *
+ * A task is allocated by the generated wrapper together with the
+ * arguments and the result of the call, and is its future. Tasks
+ * are handed to an executor through the cobj_exec_submit method,
+ * ordered ones through the strand of their object first: a strand
+ * is a lock-free queue of the ordered calls to the objects hashing
+ * to it, which is submitted as a task of its own whenever it
+ * becomes non-empty and runs its calls one at a time.
+ */
+
+/*
+ * Strands, a multi-producer single-consumer queue with a stub
+ * node. A strand is only run by one thread at a time, pending
+ * counts the calls queued and the one running.
+ */
+#define COBJ_STRANDS 256
+#define COBJ_STRAND_BATCH 64  /* calls run before requeueing */
+
+struct cobj_strand {
+  struct cobj_task run;         /* runs the strand, must be first */
+  cobj_t exec;                  /* executor it runs on */
+  struct cobj_task *head;       /* consumer end */
+  struct cobj_task *tail;       /* producer end */
+  struct cobj_task stub;
+  u_long pending;               /* calls not yet completed */
+} COBJ_ALIGNED;
+
+static struct cobj_strand cobj_strands[COBJ_STRANDS];
+static pthread_once_t cobj_strands_once = PTHREAD_ONCE_INIT;
+
+static void cobj_strand_run(struct cobj_task *rt);
+
+static void
+cobj_strands_init(void) {
+  struct cobj_strand *st;
+  u_int i;
+
+  for (i = 0; i < COBJ_STRANDS; i++) {
+    st = &cobj_strands[i];
+    st->run.fn = cobj_strand_run;
+    st->head = st->tail = &st->stub;
+  }
+}
+
+static void
+cobj_strand_push(struct cobj_strand *st, struct cobj_task *t) {
+  struct cobj_task *prev;
+
+  t->next = NULL;
+  prev = __atomic_exchange_n(&st->tail, t, __ATOMIC_ACQ_REL);
+  __atomic_store_n(&prev->next, t, __ATOMIC_RELEASE);
+}
+
+/*
+ * Take the oldest call off a strand, NULL if there is none
+ * or the producer queueing it has not linked it in yet.
+ */
+static struct cobj_task *
+cobj_strand_pop(struct cobj_strand *st) {
+  struct cobj_task *head, *next;
+
+  head = st->head;
+  next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+
+  if (head == &st->stub) {
+    if (next == NULL)
+      return (NULL);
+    st->head = head = next;
+    next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+  }
+
+  if (next != NULL) {
+    st->head = next;
+    return (head);
+  }
+
+  if (head != __atomic_load_n(&st->tail, __ATOMIC_ACQUIRE))
+    return (NULL);
+
+  cobj_strand_push(st, &st->stub);
+
+  if ((next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE)) != NULL) {
+    st->head = next;
+    return (head);
+  }
+
+  return (NULL);
+}
+
+static void
+cobj_strand_run(struct cobj_task *rt) {
+  struct cobj_strand *st;
+  struct cobj_task *t;
+  u_int n;
+
+  st = (struct cobj_strand *)rt;
+
+  for (n = 0;; n++) {
+    /*
+     * Let other tasks have the thread now and then, nobody
+     * else schedules the strand while it has calls queued.
+     */
+    if (n == COBJ_STRAND_BATCH) {
+      if (COBJ_EXEC_SUBMIT(st->exec, &st->run) == 0)
+        return;
+      n = 0;
+    }
+
+    while ((t = cobj_strand_pop(st)) == NULL)
+      sched_yield();
+
+    cobj_task_run(t);
+
+    if (__atomic_sub_fetch(&st->pending, 1, __ATOMIC_ACQ_REL) == 0)
+      return;
+  }
+}
+
+void *
+cobj_task_alloc(size_t size) {
+  struct cobj_task *t;
+
+  if (size < sizeof(*t))
+    return (NULL);
+
+  if ((t = cobj_allocator->alloc(cobj_allocator, size)) != NULL)
+    t->size = size;
+
+  return (t);
+}
+
+/*
+ * Make the call of a task and complete its future, for executors.
+ */
+void cobj_task_run(struct cobj_task *t) {
+
+  (*t->fn)(t);
+
+  if ((t->flags & COBJ_TASK_FUTURE) != 0 &&
+      __atomic_exchange_n(&t->state, COBJ_TASK_DONE, __ATOMIC_ACQ_REL) ==
+          COBJ_TASK_DETACHED)
+    cobj_future_free(t);
+}
+
+/*
+ * Queue the call of fn on obj, by exec or the default executor.
+ * Takes the task, which is freed if it can't be queued.
+ */
+cobj_future_t
+cobj_async(cobj_t exec, struct cobj_task *t, cobj_task_fn_t *fn,
+           cobj_t obj, u_int flags) {
+  struct cobj_strand *st;
+
+  if (t == NULL)
+    return (NULL);
+
+  if (exec == NULL && (exec = cobj_exec_default()) == NULL) {
+    cobj_future_free(t);
+    return (NULL);
+  }
+
+  t->fn = fn;
+  t->obj = obj;
+  t->flags = flags | COBJ_TASK_FUTURE;
+  t->state = COBJ_TASK_PENDING;
+
+  if ((flags & COBJ_ASYNC_ORDERED) == 0 || obj == NULL) {
+    if (COBJ_EXEC_SUBMIT(exec, t) != 0) {
+      cobj_future_free(t);
+      return (NULL);
+    }
+    return (t);
+  }
+
+  (void)pthread_once(&cobj_strands_once, cobj_strands_init);
+
+  st = &cobj_strands[(u_int)(((uintptr_t)obj >> 4) * 0x9e3779b1U) >> 24];
+
+  cobj_strand_push(st, t);
+
+  /*
+   * Whoever finds the strand idle schedules it, and runs
+   * it right here if the executor turns it down.
+   */
+  if (__atomic_fetch_add(&st->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+    st->exec = exec;
+    if (COBJ_EXEC_SUBMIT(exec, &st->run) != 0)
+      cobj_strand_run(&st->run);
+  }
+
+  return (t);
+}
+
+int cobj_future_done(cobj_future_t f) {
+
+  return (__atomic_load_n(&f->state, __ATOMIC_ACQUIRE) == COBJ_TASK_DONE);
+}
+
+void cobj_future_free(cobj_future_t f) {
+
+  cobj_allocator->free(cobj_allocator, f, f->size);
+}
+
+/*
+ * Drop the future, the task is freed once it has run.
+ */
+void cobj_future_detach(cobj_future_t f) {
+
+  if (__atomic_exchange_n(&f->state, COBJ_TASK_DETACHED, __ATOMIC_ACQ_REL) ==
+      COBJ_TASK_DONE)
+    cobj_future_free(f);
+}
+
+/*
+ * Work-stealing pool.
+ *
+ * Every worker owns a bounded deque, which it pushes tasks it
+ * submits itself onto and pops them from at the bottom while
+ * idle workers steal from the top (Chase and Lev, in the form
+ * of Le et al. for weak memory models). Tasks submitted from
+ * other threads, and those not fitting a deque, go into the
+ * injection queue of the pool. Workers sleep when they find
+ * nothing to do anywhere; they announce that in nidle before
+ * looking one last time, and submitters wake one after making
+ * a task visible if there are any.
+ */
+#define COBJ_DEQUE_SIZE 1024  /* power of two */
+
+struct cobj_deque {
+  long top COBJ_ALIGNED;        /* thieves take from here */
+  long bottom COBJ_ALIGNED;     /* owner pushes and pops here */
+  struct cobj_task *slot[COBJ_DEQUE_SIZE] COBJ_ALIGNED;
+};
+
+struct cobj_pool_worker {
+  struct cobj_deque dq;
+  struct cobj_pool *pool;
+  pthread_t thread;
+  u_int seed;                   /* victim selection */
+  int started;
+};
+
+struct cobj_pool {
+  COBJ_FIELDS;
+  struct cobj_pool_worker **workers;
+  int nworkers;
+  u_int stop;                   /* refuse tasks, exit when idle */
+  u_int nidle;                  /* workers going to sleep */
+  u_long ninject;               /* tasks in the injection queue */
+  pthread_mutex_t lock;         /* injection queue, sleep */
+  pthread_cond_t cv;
+  struct cobj_task *head;       /* injection queue */
+  struct cobj_task *tail;
+};
+
+static __thread struct cobj_pool_worker *cobj_pool_self;
+
+static cobj_t cobj_exec_dflt;
+static pthread_once_t cobj_exec_once = PTHREAD_ONCE_INIT;
+
+#define COBJ_WAIT_SPINS 128  /* polls before yielding the CPU */
+
+static int
+cobj_deque_push(struct cobj_deque *dq, struct cobj_task *t) {
+  long b, top;
+
+  b = __atomic_load_n(&dq->bottom, __ATOMIC_RELAXED);
+  top = __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE);
+
+  if (b - top >= COBJ_DEQUE_SIZE)
+    return (-1);
+
+  __atomic_store_n(&dq->slot[b & (COBJ_DEQUE_SIZE - 1)], t, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED);
+
+  return (0);
+}
+
+static struct cobj_task *
+cobj_deque_pop(struct cobj_deque *dq) {
+  struct cobj_task *t;
+  long b, top;
+
+  b = __atomic_load_n(&dq->bottom, __ATOMIC_RELAXED) - 1;
+  __atomic_store_n(&dq->bottom, b, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  top = __atomic_load_n(&dq->top, __ATOMIC_RELAXED);
+
+  if (top > b) {
+    __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED);
+    return (NULL);
+  }
+
+  t = __atomic_load_n(&dq->slot[b & (COBJ_DEQUE_SIZE - 1)], __ATOMIC_RELAXED);
+
+  if (top == b) {
+    /*
+     * Last task, race the thieves for it.
+     */
+    if (!__atomic_compare_exchange_n(&dq->top, &top, top + 1, 0,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+      t = NULL;
+    __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED);
+  }
+
+  return (t);
+}
+
+static struct cobj_task *
+cobj_deque_steal(struct cobj_deque *dq) {
+  struct cobj_task *t;
+  long b, top;
+
+  top = __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  b = __atomic_load_n(&dq->bottom, __ATOMIC_ACQUIRE);
+
+  if (top >= b)
+    return (NULL);
+
+  t = __atomic_load_n(&dq->slot[top & (COBJ_DEQUE_SIZE - 1)],
+                      __ATOMIC_RELAXED);
+
+  if (!__atomic_compare_exchange_n(&dq->top, &top, top + 1, 0,
+                                   __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+    return (NULL);
+
+  return (t);
+}
+
+static int
+cobj_deque_empty(struct cobj_deque *dq) {
+
+  return (__atomic_load_n(&dq->top, __ATOMIC_ACQUIRE) >=
+          __atomic_load_n(&dq->bottom, __ATOMIC_ACQUIRE));
+}
+
+static struct cobj_task *
+cobj_pool_take(struct cobj_pool *pool) {
+  struct cobj_task *t;
+
+  if (__atomic_load_n(&pool->ninject, __ATOMIC_ACQUIRE) == 0)
+    return (NULL);
+
+  (void)pthread_mutex_lock(&pool->lock);
+
+  if ((t = pool->head) != NULL) {
+    if ((pool->head = t->next) == NULL)
+      pool->tail = NULL;
+    __atomic_store_n(&pool->ninject, pool->ninject - 1, __ATOMIC_RELEASE);
+  }
+
+  (void)pthread_mutex_unlock(&pool->lock);
+
+  return (t);
+}
+
+/*
+ * Find a task for a worker: its own newest, the oldest of
+ * another worker starting at a random one, or one injected.
+ */
+static struct cobj_task *
+cobj_pool_find(struct cobj_pool_worker *w) {
+  struct cobj_pool *pool;
+  struct cobj_task *t;
+  int i, n, v;
+
+  pool = w->pool;
+
+  if ((t = cobj_deque_pop(&w->dq)) != NULL)
+    return (t);
+
+  if ((t = cobj_pool_take(pool)) != NULL)
+    return (t);
+
+  n = pool->nworkers;
+  w->seed = w->seed * 1103515245 + 12345;
+  v = (w->seed >> 16) % n;
+
+  for (i = 0; i < n; i++, v = (v + 1) % n) {
+    if (pool->workers[v] == w)
+      continue;
+    if ((t = cobj_deque_steal(&pool->workers[v]->dq)) != NULL)
+      return (t);
+  }
+
+  return (NULL);
+}
+
+static int
+cobj_pool_idle(struct cobj_pool *pool) {
+  int i;
+
+  if (__atomic_load_n(&pool->ninject, __ATOMIC_ACQUIRE) != 0)
+    return (0);
+
+  for (i = 0; i < pool->nworkers; i++) {
+    if (!cobj_deque_empty(&pool->workers[i]->dq))
+      return (0);
+  }
+
+  return (1);
+}
+
+static void *
+cobj_pool_main(void *arg) {
+  struct cobj_pool_worker *w;
+  struct cobj_pool *pool;
+  struct cobj_task *t;
+
+  w = arg;
+  pool = w->pool;
+
+  cobj_pool_self = w;
+
+  for (;;) {
+    if ((t = cobj_pool_find(w)) != NULL) {
+      cobj_task_run(t);
+      continue;
+    }
+
+    (void)pthread_mutex_lock(&pool->lock);
+
+    __atomic_add_fetch(&pool->nidle, 1, __ATOMIC_SEQ_CST);
+
+    if (cobj_pool_idle(pool)) {
+      if (pool->stop) {
+        __atomic_sub_fetch(&pool->nidle, 1, __ATOMIC_RELAXED);
+        (void)pthread_mutex_unlock(&pool->lock);
+        break;
+      }
+      (void)pthread_cond_wait(&pool->cv, &pool->lock);
+    }
+
+    __atomic_sub_fetch(&pool->nidle, 1, __ATOMIC_RELAXED);
+
+    (void)pthread_mutex_unlock(&pool->lock);
+  }
+
+  cobj_pool_self = NULL;
+
+  return (NULL);
+}
+
+static int
+cobj_pool_submit(cobj_t o, struct cobj_task *t) {
+  struct cobj_pool_worker *w;
+  struct cobj_pool *pool;
+
+  pool = (struct cobj_pool *)o;
+
+  if (__atomic_load_n(&pool->stop, __ATOMIC_ACQUIRE))
+    return (-1);
+
+  w = cobj_pool_self;
+
+  if (w == NULL || w->pool != pool || cobj_deque_push(&w->dq, t) != 0) {
+    t->next = NULL;
+
+    (void)pthread_mutex_lock(&pool->lock);
+
+    if (pool->tail != NULL)
+      pool->tail->next = t;
+    else
+      pool->head = t;
+    pool->tail = t;
+    __atomic_store_n(&pool->ninject, pool->ninject + 1, __ATOMIC_RELEASE);
+
+    (void)pthread_mutex_unlock(&pool->lock);
+  }
+
+  /*
+   * Pairs with the increment of nidle by a worker about
+   * to check for tasks a last time before it sleeps.
+   */
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+  if (__atomic_load_n(&pool->nidle, __ATOMIC_RELAXED) != 0) {
+    (void)pthread_mutex_lock(&pool->lock);
+    (void)pthread_cond_signal(&pool->cv);
+    (void)pthread_mutex_unlock(&pool->lock);
+  }
+
+  return (0);
+}
+
+static cobj_method_t cobj_pool_methods[] = {
+    COBJ_METHOD(cobj_exec_submit, cobj_pool_submit),
+    COBJ_METHOD_END};
+
+DEFINE_CLASS_0(cobj_pool, cobj_pool_class, cobj_pool_methods,
+               sizeof(struct cobj_pool));
+
+cobj_t cobj_pool_create(int nthreads) {
+  struct cobj_pool_worker *w;
+  struct cobj_pool *pool;
+  long ncpu;
+  int i;
+
+  if (nthreads <= 0) {
+    ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    nthreads = (ncpu > 0) ? (int)ncpu : 1;
+  }
+
+  if ((pool = (struct cobj_pool *)cobj_create(&cobj_pool_class)) == NULL)
+    return (NULL);
+
+  (void)pthread_mutex_init(&pool->lock, NULL);
+  (void)pthread_cond_init(&pool->cv, NULL);
+
+  if ((pool->workers = calloc(nthreads, sizeof(*pool->workers))) == NULL)
+    goto fail;
+
+  for (i = 0; i < nthreads; i++) {
+    if (posix_memalign((void **)&w, COBJ_CACHE_LINE, sizeof(*w)) != 0)
+      goto fail;
+
+    memset(w, 0, sizeof(*w));
+    w->pool = pool;
+    w->seed = i + 1;
+    pool->workers[pool->nworkers++] = w;
+  }
+
+  /*
+   * Workers look at each other's deques, start them once
+   * all are in place.
+   */
+  for (i = 0; i < pool->nworkers; i++) {
+    w = pool->workers[i];
+    if (pthread_create(&w->thread, NULL, cobj_pool_main, w) != 0)
+      goto fail;
+    w->started = 1;
+  }
+
+  return ((cobj_t)pool);
+
+fail:
+  (void)cobj_pool_destroy((cobj_t)pool);
+
+  return (NULL);
+}
+
+int cobj_pool_destroy(cobj_t o) {
+  struct cobj_pool *pool;
+  int i;
+
+  if (o == NULL || !cobj_isa(o, &cobj_pool_class))
+    return (-1);
+
+  pool = (struct cobj_pool *)o;
+
+  (void)pthread_mutex_lock(&pool->lock);
+  __atomic_store_n(&pool->stop, 1, __ATOMIC_RELEASE);
+  (void)pthread_cond_broadcast(&pool->cv);
+  (void)pthread_mutex_unlock(&pool->lock);
+
+  for (i = 0; i < pool->nworkers; i++) {
+    if (pool->workers[i]->started)
+      (void)pthread_join(pool->workers[i]->thread, NULL);
+  }
+
+  for (i = 0; i < pool->nworkers; i++)
+    free(pool->workers[i]);
+  free(pool->workers);
+
+  (void)pthread_cond_destroy(&pool->cv);
+  (void)pthread_mutex_destroy(&pool->lock);
+
+  /*
+   * Stop handing out a default executor which is gone.
+   */
+  (void)__atomic_compare_exchange_n(&cobj_exec_dflt, &o, NULL, 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+
+  return (cobj_delete((cobj_t)pool));
+}
+
+static void
+cobj_exec_init(void) {
+  cobj_t exec, prev;
+
+  if ((exec = cobj_pool_create(0)) == NULL)
+    return;
+
+  prev = NULL;
+  if (!__atomic_compare_exchange_n(&cobj_exec_dflt, &prev, exec, 0,
+                                   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    (void)cobj_pool_destroy(exec);
+}
+
+/*
+ * The default executor, a pool with a thread per CPU which is
+ * created on first use unless another one has been set.
+ */
+cobj_t cobj_exec_default(void) {
+  cobj_t exec;
+
+  if ((exec = __atomic_load_n(&cobj_exec_dflt, __ATOMIC_ACQUIRE)) != NULL)
+    return (exec);
+
+  (void)pthread_once(&cobj_exec_once, cobj_exec_init);
+
+  return (__atomic_load_n(&cobj_exec_dflt, __ATOMIC_ACQUIRE));
+}
+
+cobj_t cobj_exec_set_default(cobj_t exec) {
+
+  return (__atomic_exchange_n(&cobj_exec_dflt, exec, __ATOMIC_ACQ_REL));
+}
+
+/*
+ * Wait for a call to complete. A worker of a pool runs other
+ * tasks of its pool meanwhile, so that tasks waiting for each
+ * other can't take all of its workers.
+ */
+void cobj_future_wait(cobj_future_t f) {
+  struct cobj_pool_worker *w;
+  struct cobj_task *t;
+  u_int spins;
+
+  w = cobj_pool_self;
+
+  for (spins = 0; !cobj_future_done(f); spins++) {
+    if (w != NULL && (t = cobj_pool_find(w)) != NULL)
+      cobj_task_run(t);
+    else if (spins >= COBJ_WAIT_SPINS)
+      sched_yield();
+  }
+}
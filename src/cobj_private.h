@@ -0,0 +1,149 @@
+/*-
+ * Copyright (c) 2019 Henning Matyschok
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _COBJ_PRIVATE_H_
+#define _COBJ_PRIVATE_H_
+
+/*
+ * Library internals shared between the cobj(3) sources.
+ */
+
+/*
+ * Sharded reference count of a class. Each thread is assigned
+ * one of the shards, so that creating and deleting instances
+ * only writes a cache line which is rarely shared. A shard may
+ * go negative when an instance is deleted by another thread
+ * than the one which created it, only the sum is meaningful.
+ * The shards below zero are counted, while there are any a
+ * positive shard does not tell that instances are left.
+ */
+#define COBJ_REF_SHARDS 16
+
+struct cobj_refs {
+  struct {
+    u_long count;
+  } COBJ_ALIGNED shard[COBJ_REF_SHARDS];
+  u_long negative COBJ_ALIGNED;  /* shards below zero */
+};
+
+/*
+ * Per-thread records. Each list hands out records of one size,
+ * which start with struct cobj_thread_rec, a record to a thread.
+ * When the thread exits, the exit hook of the list is called on
+ * its record, which is then handed to the next thread asking for
+ * one with whatever the hook left in it. Records are never freed,
+ * COBJ_THREAD_FOREACH() walks all of them.
+ */
+struct cobj_thread_recs;
+
+struct cobj_thread_rec {
+  struct cobj_thread_recs *recs;  /* list of the record */
+  struct cobj_thread_rec *next;   /* all records, never unlinked */
+  struct cobj_thread_rec *owned;  /* next record of the same thread */
+  u_int inuse;                    /* owned by a thread */
+};
+
+typedef void cobj_thread_exit_t(struct cobj_thread_rec *rec);
+
+struct cobj_thread_recs {
+  struct cobj_thread_rec *head;
+  size_t size;                    /* bytes per record */
+  cobj_thread_exit_t *exit;       /* owner exited, may be NULL */
+};
+
+#define COBJ_THREAD_RECS(type, exit) { NULL, sizeof(type), (exit) }
+
+#define COBJ_THREAD_FOREACH(var, recs)                                 \
+  for ((var) = (void *)__atomic_load_n(&(recs)->head, __ATOMIC_ACQUIRE); \
+       (var) != NULL;                                                    \
+       (var) = (void *)((struct cobj_thread_rec *)(var))->next)
+
+__BEGIN_DECLS
+/*
+ * Record of the calling thread on the list, zeroed when it is
+ * new, or NULL if none can be allocated. Callers keep it in a
+ * thread-local pointer of their own.
+ */
+void *cobj_thread_rec(struct cobj_thread_recs *recs);
+
+/*
+ * Take and drop a reference on a class, unref returns
+ * non-zero when it has seen the last one go away.
+ */
+void cobj_class_ref(cobj_class_t cls, int canalloc);
+int cobj_class_unref(cobj_class_t cls);
+
+/*
+ * Sum of the references on a class.
+ */
+u_long cobj_class_refs(cobj_class_t cls);
+
+/*
+ * Point an object at the ops table of its class, by pointer
+ * or by index, see COBJ_COMPACT. COBJ_CLEAR() unlinks it.
+ */
+int cobj_init_ops(cobj_t obj, cobj_class_t cls);
+
+#ifdef COBJ_COMPACT
+u_int cobj_registry_enter(cobj_class_t cls, cobj_ops_t ops);
+
+#define COBJ_CLEAR(OBJ) ((OBJ)->cid = 0)
+#else
+#define COBJ_CLEAR(OBJ) ((OBJ)->ops = NULL)
+#endif
+
+/*
+ * The default allocator, see cobj_set_allocator(3).
+ */
+extern cobj_allocator_t cobj_allocator;
+
+#define COBJ_ALLOCATOR(cls) \
+  (((cls)->allocator != NULL) ? (cls)->allocator : cobj_allocator)
+
+/*
+ * Retire an unpublished ops table of the given size, and take
+ * a retired one of the class back, see cobj_ops_reclaim(3).
+ */
+void cobj_ops_retire(cobj_ops_t ops, size_t size);
+cobj_ops_t cobj_ops_reuse(cobj_class_t cls);
+
+/*
+ * Drop the hold a table has on the IDs of its methods before
+ * it is freed, releasing those no other table uses.
+ */
+void cobj_ops_release(cobj_ops_t ops);
+
+extern struct cobj_ops_stats cobj_ops_counters;
+
+/*
+ * Account a cache miss, see cobj_stats_snapshot(3). The
+ * lookup took nsec nanoseconds by cobj_stats_clock().
+ */
+void cobj_stats_miss(cobj_class_t cls, cobjop_desc_t desc, int deflt,
+                     u_long nsec);
+u_long cobj_stats_clock(void);
+__END_DECLS
+#endif /* !_COBJ_PRIVATE_H_ */
@@ -0,0 +1,654 @@
+/*-
+ * Copyright (c) 2019 Henning Matyschok
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libcobj.h>
+
+#include "cobj_private.h"
+#include "cobj_snap_if.h"
+
+/*
+ * Snapshots.
+ *
+ * A snapshot file holds copies of objects, the memory they refer
+ * to and, at its end, one slot per class for an ops table. The
+ * ops field of every object points to the slot of its class at
+ * the address the file is meant to be mapped at, so it is really
+ * the index of the class in the snapshot. Loading a snapshot maps
+ * the file privately at that address and copies the head of the
+ * compiled table of each class into its slot; the objects are not
+ * touched, their pages are faulted in as they are dispatched on,
+ * and the cache of a slot fills as methods are called. Only when
+ * the address is taken are the ops fields of all objects relinked.
+ *
+ * With COBJ_COMPACT, objects store the index of their class in
+ * cobj_registry instead and there are no slots. Only objects of a
+ * class which has another index in the loading process are
+ * rewritten.
+ *
+ * Pointers from an object into the snapshot are stored as offsets
+ * from the start of the file by the cobj_snap_save method of its
+ * class and turned back into pointers by cobj_snap_load, which is
+ * only called on objects of classes implementing it.
+ */
+
+#define COBJ_SNAP_MAGIC "COBJSNP1"
+#define COBJ_SNAP_NAMELEN 64
+#define COBJ_SNAP_ALIGN 16    /* alignment of objects and data */
+
+/*
+ * Object header, the width of the index with COBJ_COMPACT.
+ */
+#ifdef COBJ_COMPACT
+#define COBJ_SNAP_LAYOUT COBJ_COMPACT
+#else
+#define COBJ_SNAP_LAYOUT 0
+#endif
+
+#if __SIZEOF_POINTER__ == 8
+#define COBJ_SNAP_BASE 0x200000000000UL
+#else
+#define COBJ_SNAP_BASE 0x60000000UL
+#endif
+
+/*
+ * Bytes per ops table slot, enough for the largest cache.
+ */
+#ifdef COBJ_COMPACT
+#define COBJ_SNAP_STRIDE 0
+#else
+#define COBJ_SNAP_STRIDE \
+  ((COBJ_OPS_SIZE(COBJ_CACHE_SIZE) + COBJ_CACHE_LINE - 1) & \
+   ~(size_t)(COBJ_CACHE_LINE - 1))
+#endif
+
+struct cobj_snap_hdr {
+  char magic[8];        /* COBJ_SNAP_MAGIC */
+  u_int ptrsize;        /* sizeof(void *) of the writer */
+  u_int nclasses;       /* entries in the class table */
+  u_int layout;         /* COBJ_SNAP_LAYOUT of the writer */
+  u_int pad;
+  u_long nobjs;         /* entries in the object table */
+  u_long base;          /* address the file is mapped at */
+  u_long size;          /* file size */
+  u_long classes;       /* offset of the class table */
+  u_long objs;          /* offset of the object table */
+  u_long ops;           /* offset of the ops table slots */
+};
+
+struct cobj_snap_class {
+  char name[COBJ_SNAP_NAMELEN];
+  u_long size;          /* object size */
+  u_long first;         /* first and last object of the class */
+  u_long last;
+  u_int cid;            /* index in cobj_registry, if compact */
+  u_int pad;
+};
+
+struct cobj_snap_obj {
+  u_long off;           /* offset of the object */
+  u_int cls;            /* index into the class table */
+  u_int pad;
+};
+
+#define COBJ_SNAP_HDRSIZE \
+  ((sizeof(struct cobj_snap_hdr) + COBJ_SNAP_ALIGN - 1) & \
+   ~(size_t)(COBJ_SNAP_ALIGN - 1))
+
+struct cobj_snap {
+  char *buf;                    /* file contents */
+  size_t len;
+  size_t cap;
+  cobj_class_t *classes;        /* classes seen */
+  u_int nclasses;
+  u_int capclasses;
+  struct cobj_snap_obj *objs;   /* objects added */
+  u_long nobjs;
+  u_long capobjs;
+};
+
+struct cobj_snap_map {
+  char *base;                   /* mapping */
+  size_t size;
+  struct cobj_snap_hdr hdr;
+  cobj_class_t *classes;        /* by index in the snapshot */
+  struct cobj_snap_obj *objs;
+};
+
+/*
+ * Whether the class implements a method other than by default.
+ */
+static int
+cobj_snap_implements(cobj_class_t cls, cobjop_desc_t desc) {
+
+  return (cobj_call_method(cls, NULL, desc) != &desc->deflt);
+}
+
+/*
+ * Extend the snapshot to size bytes at off, zeroing everything
+ * past its current end.
+ */
+static int
+cobj_snap_grow(cobj_snap_t snap, size_t off, size_t size) {
+  size_t cap;
+  char *buf;
+
+  if (off + size > snap->cap) {
+    for (cap = snap->cap ? snap->cap : 4096; cap < off + size; cap *= 2)
+      ;
+
+    if ((buf = realloc(snap->buf, cap)) == NULL)
+      return (-1);
+
+    snap->buf = buf;
+    snap->cap = cap;
+  }
+
+  memset(snap->buf + snap->len, 0, off + size - snap->len);
+  snap->len = off + size;
+
+  return (0);
+}
+
+/*
+ * Reserve zeroed space in the snapshot, returns its offset or
+ * 0 when out of memory. The space may move with every further
+ * allocation, cobj_snap_at(3) has to be asked for it again.
+ */
+u_long
+cobj_snap_alloc(cobj_snap_t snap, size_t size) {
+  size_t off;
+
+  off = (snap->len + COBJ_SNAP_ALIGN - 1) & ~(size_t)(COBJ_SNAP_ALIGN - 1);
+
+  if (cobj_snap_grow(snap, off, size) != 0)
+    return (0);
+
+  return (off);
+}
+
+cobj_snap_t
+cobj_snap_create(void) {
+  cobj_snap_t snap;
+
+  if ((snap = calloc(1, sizeof(*snap))) == NULL)
+    return (NULL);
+
+  if (cobj_snap_grow(snap, 0, COBJ_SNAP_HDRSIZE) != 0) {
+    free(snap);
+    return (NULL);
+  }
+
+  return (snap);
+}
+
+void *
+cobj_snap_at(cobj_snap_t snap, u_long off) {
+
+  return (snap->buf + off);
+}
+
+static int
+cobj_snap_class(cobj_snap_t snap, cobj_class_t cls) {
+  cobj_class_t *classes;
+  u_int i, n;
+
+  for (i = 0; i < snap->nclasses; i++) {
+    if (snap->classes[i] == cls)
+      return (i);
+  }
+
+  if (cls->name == NULL || strlen(cls->name) >= COBJ_SNAP_NAMELEN)
+    return (-1);
+
+  if (snap->nclasses == snap->capclasses) {
+    n = snap->capclasses ? snap->capclasses * 2 : 8;
+    if ((classes = realloc(snap->classes, n * sizeof(*classes))) == NULL)
+      return (-1);
+    snap->classes = classes;
+    snap->capclasses = n;
+  }
+
+  snap->classes[snap->nclasses] = cls;
+
+  return (snap->nclasses++);
+}
+
+/*
+ * Copy an object into the snapshot and let its class store what
+ * it refers to, returns the offset of the copy or 0 on failure.
+ */
+u_long
+cobj_snap_add(cobj_snap_t snap, cobj_t obj) {
+  struct cobj_snap_obj *objs;
+  cobj_class_t cls;
+  u_long off, n;
+  int idx;
+
+  if (snap == NULL || obj == NULL)
+    return (0);
+
+  cls = COBJ_OPS(obj)->cls;
+
+  if ((idx = cobj_snap_class(snap, cls)) < 0)
+    return (0);
+
+  if ((off = cobj_snap_alloc(snap, cls->size)) == 0)
+    return (0);
+
+  memcpy(snap->buf + off, obj, cls->size);
+  COBJ_CLEAR((cobj_t)(snap->buf + off));
+
+  if (COBJ_SNAP_SAVE(obj, snap, off) != 0)
+    return (0);
+
+  if (snap->nobjs == snap->capobjs) {
+    n = snap->capobjs ? snap->capobjs * 2 : 64;
+    if ((objs = realloc(snap->objs, n * sizeof(*objs))) == NULL)
+      return (0);
+    snap->objs = objs;
+    snap->capobjs = n;
+  }
+
+  snap->objs[snap->nobjs].off = off;
+  snap->objs[snap->nobjs].cls = idx;
+  snap->objs[snap->nobjs].pad = 0;
+  snap->nobjs++;
+
+  return (off);
+}
+
+/*
+ * Append the tables, point the objects at the slots of their
+ * classes and write the file.
+ */
+int cobj_snap_write(cobj_snap_t snap, const char *path) {
+  struct cobj_snap_class *sc;
+  struct cobj_snap_hdr hdr;
+  size_t done, len, pg;
+  ssize_t n;
+  u_long i;
+  int fd, error;
+
+  if (snap == NULL || path == NULL)
+    return (-1);
+
+  len = snap->len;
+  pg = getpagesize();
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, COBJ_SNAP_MAGIC, sizeof(hdr.magic));
+  hdr.ptrsize = sizeof(void *);
+  hdr.layout = COBJ_SNAP_LAYOUT;
+  hdr.nclasses = snap->nclasses;
+  hdr.nobjs = snap->nobjs;
+  hdr.base = COBJ_SNAP_BASE;
+
+  /*
+	 * The slots start on a page, keeping the pages of the
+	 * objects clean when they are filled in.
+	 */
+  error = -1;
+  if ((hdr.classes = cobj_snap_alloc(snap, snap->nclasses *
+                                               sizeof(*sc))) == 0 ||
+      (hdr.objs = cobj_snap_alloc(snap, snap->nobjs *
+                                            sizeof(*snap->objs))) == 0)
+    goto out;
+
+  hdr.ops = (snap->len + pg - 1) & ~(pg - 1);
+  if (cobj_snap_grow(snap, hdr.ops, snap->nclasses * COBJ_SNAP_STRIDE) != 0)
+    goto out;
+
+  hdr.size = snap->len;
+
+  sc = (struct cobj_snap_class *)(snap->buf + hdr.classes);
+
+  for (i = 0; i < snap->nclasses; i++) {
+    memcpy(sc[i].name, snap->classes[i]->name, strlen(snap->classes[i]->name));
+    sc[i].size = snap->classes[i]->size;
+    sc[i].cid = __atomic_load_n(&snap->classes[i]->cid, __ATOMIC_RELAXED);
+    sc[i].first = snap->nobjs;
+  }
+
+  for (i = 0; i < snap->nobjs; i++) {
+    if (sc[snap->objs[i].cls].first == snap->nobjs)
+      sc[snap->objs[i].cls].first = i;
+    sc[snap->objs[i].cls].last = i;
+  }
+
+  memcpy(snap->buf + hdr.objs, snap->objs, snap->nobjs * sizeof(*snap->objs));
+
+  for (i = 0; i < snap->nobjs; i++) {
+#ifdef COBJ_COMPACT
+    ((cobj_t)(snap->buf + snap->objs[i].off))->cid =
+        sc[snap->objs[i].cls].cid;
+#else
+    ((cobj_t)(snap->buf + snap->objs[i].off))->ops =
+        (cobj_ops_t)(hdr.base + hdr.ops + snap->objs[i].cls * COBJ_SNAP_STRIDE);
+#endif
+  }
+
+  memcpy(snap->buf, &hdr, sizeof(hdr));
+
+  if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+    goto out;
+
+  for (done = 0; done < hdr.size; done += n) {
+    if ((n = write(fd, snap->buf + done, hdr.size - done)) < 0) {
+      if (errno == EINTR) {
+        n = 0;
+        continue;
+      }
+      break;
+    }
+  }
+
+  if (close(fd) == 0 && done == hdr.size)
+    error = 0;
+out:
+  /*
+	 * Objects may still be added, the tables are appended
+	 * again by the next write.
+	 */
+  snap->len = len;
+
+  return (error);
+}
+
+void cobj_snap_destroy(cobj_snap_t snap) {
+
+  if (snap == NULL)
+    return;
+
+  free(snap->buf);
+  free(snap->classes);
+  free(snap->objs);
+  free(snap);
+}
+
+#ifndef COBJ_COMPACT
+/*
+ * Fill in the slot of a class with the head of its compiled table.
+ * The copy shares the generation, index, resolution order and super
+ * table of the original, which the reference taken by the caller
+ * keeps alive for as long as the snapshot is mapped.
+ */
+static int
+cobj_snap_link(cobj_snap_map_t map, u_int idx) {
+  cobj_class_t cls;
+  cobj_ops_t ops;
+  size_t nslots;
+
+  cls = map->classes[idx];
+  ops = __atomic_load_n(&cls->ops, __ATOMIC_ACQUIRE);
+  nslots = (size_t)1 << (32 - ops->shift);
+
+  if (nslots > COBJ_CACHE_SIZE)
+    return (-1);
+
+  memcpy(map->base + map->hdr.ops + idx * COBJ_SNAP_STRIDE, ops,
+         COBJ_OPS_SIZE(nslots));
+
+  return (0);
+}
+#endif /* ! COBJ_COMPACT */
+
+/*
+ * Whether a table of n entries of the given size at off lies
+ * within a file of size bytes, aligned like the snapshot data.
+ */
+static int
+cobj_snap_fits(u_long size, u_long off, u_long n, size_t elem) {
+
+  if (off > size || (off & (COBJ_SNAP_ALIGN - 1)) != 0)
+    return (0);
+
+  return (elem == 0 || n <= (size - off) / elem);
+}
+
+/*
+ * Check the class and object tables of a mapped snapshot before
+ * anything is written to it: every object has to be a known class
+ * and lie within the data between the header and the tables.
+ */
+static int
+cobj_snap_check(cobj_snap_map_t map, struct cobj_snap_class *sc) {
+  struct cobj_snap_obj *so;
+  u_long end, i;
+  u_int c;
+
+  end = map->hdr.classes;
+  if (map->hdr.objs < end)
+    end = map->hdr.objs;
+  if (map->hdr.ops < end)
+    end = map->hdr.ops;
+
+  for (c = 0; c < map->hdr.nclasses; c++) {
+    if (sc[c].size < sizeof(struct cobj) || sc[c].first > map->hdr.nobjs)
+      return (-1);
+
+    if (sc[c].first < map->hdr.nobjs &&
+        (sc[c].last < sc[c].first || sc[c].last >= map->hdr.nobjs))
+      return (-1);
+  }
+
+  for (i = 0; i < map->hdr.nobjs; i++) {
+    so = &map->objs[i];
+
+    if (so->cls >= map->hdr.nclasses ||
+        so->off < COBJ_SNAP_HDRSIZE || so->off > end ||
+        (so->off & (COBJ_SNAP_ALIGN - 1)) != 0 ||
+        sc[so->cls].size > end - so->off)
+      return (-1);
+  }
+
+  return (0);
+}
+
+cobj_snap_map_t
+cobj_snap_open(const char *path, cobj_class_t *classes) {
+  struct cobj_snap_class *sc;
+  cobj_snap_map_t map;
+  cobj_class_t *cp;
+  struct stat st;
+  u_long i;
+  u_int c;
+#ifdef COBJ_COMPACT
+  u_int cid;
+#endif
+  void *p;
+  int fd;
+
+  if (path == NULL || classes == NULL)
+    return (NULL);
+
+  if ((map = calloc(1, sizeof(*map))) == NULL)
+    return (NULL);
+
+  if ((fd = open(path, O_RDONLY)) < 0)
+    goto fail;
+
+  if (fstat(fd, &st) != 0 ||
+      pread(fd, &map->hdr, sizeof(map->hdr), 0) != sizeof(map->hdr) ||
+      memcmp(map->hdr.magic, COBJ_SNAP_MAGIC, sizeof(map->hdr.magic)) != 0 ||
+      map->hdr.ptrsize != sizeof(void *) ||
+      map->hdr.layout != COBJ_SNAP_LAYOUT ||
+      map->hdr.size != (u_long)st.st_size ||
+      !cobj_snap_fits(map->hdr.size, map->hdr.classes, map->hdr.nclasses,
+                      sizeof(*sc)) ||
+      !cobj_snap_fits(map->hdr.size, map->hdr.objs, map->hdr.nobjs,
+                      sizeof(*map->objs)) ||
+      !cobj_snap_fits(map->hdr.size, map->hdr.ops, map->hdr.nclasses,
+                      COBJ_SNAP_STRIDE)) {
+    (void)close(fd);
+    goto fail;
+  }
+
+  /*
+	 * Without MAP_FIXED the address is only a hint, we are
+	 * either given it or somewhere else.
+	 */
+  p = mmap((void *)map->hdr.base, map->hdr.size, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE, fd, 0);
+  (void)close(fd);
+
+  if (p == MAP_FAILED)
+    goto fail;
+
+  map->base = p;
+  map->size = map->hdr.size;
+  map->objs = (struct cobj_snap_obj *)(map->base + map->hdr.objs);
+
+  if ((map->classes = calloc(map->hdr.nclasses, sizeof(cobj_class_t))) ==
+      NULL)
+    goto fail;
+
+  sc = (struct cobj_snap_class *)(map->base + map->hdr.classes);
+
+  if (cobj_snap_check(map, sc) != 0)
+    goto fail;
+
+  for (c = 0; c < map->hdr.nclasses; c++) {
+    for (cp = classes; *cp != NULL; cp++) {
+      if ((*cp)->name != NULL &&
+          strncmp((*cp)->name, sc[c].name, sizeof(sc[c].name)) == 0)
+        break;
+    }
+
+    if (*cp == NULL || (*cp)->size != sc[c].size)
+      goto fail;
+
+    /*
+		 * Hold the class like an instance would, so its table
+		 * stays compiled while the snapshot is mapped.
+		 */
+    cobj_class_ref(*cp, 1);
+    map->classes[c] = *cp;
+
+    if (__atomic_load_n(&(*cp)->ops, __ATOMIC_ACQUIRE) == NULL &&
+        cobj_class_compile(*cp) != 0)
+      goto fail;
+
+#ifdef COBJ_COMPACT
+    /*
+		 * Compact objects dispatch through the registry, they
+		 * only need relinking if their class got another index
+		 * in this process.
+		 */
+    if ((cid = cobj_registry_enter(*cp, (*cp)->ops)) == 0)
+      goto fail;
+
+    for (i = sc[c].first; cid != sc[c].cid && i <= sc[c].last &&
+                          i < map->hdr.nobjs; i++) {
+      if (map->objs[i].cls == c)
+        ((cobj_t)(map->base + map->objs[i].off))->cid = cid;
+    }
+#else
+    if (cobj_snap_link(map, c) != 0)
+      goto fail;
+#endif
+  }
+
+#ifndef COBJ_COMPACT
+  if (map->base != (char *)map->hdr.base) {
+    for (i = 0; i < map->hdr.nobjs; i++)
+      ((cobj_t)(map->base + map->objs[i].off))->ops =
+          (cobj_ops_t)(map->base + map->hdr.ops +
+                       map->objs[i].cls * COBJ_SNAP_STRIDE);
+  }
+#endif
+
+  for (c = 0; c < map->hdr.nclasses; c++) {
+    if (!cobj_snap_implements(map->classes[c], &cobj_snap_load_desc))
+      continue;
+
+    for (i = sc[c].first; i <= sc[c].last && i < map->hdr.nobjs; i++) {
+      if (map->objs[i].cls == c &&
+          COBJ_SNAP_LOAD((cobj_t)(map->base + map->objs[i].off),
+                         map->base) != 0)
+        goto fail;
+    }
+  }
+
+  return (map);
+fail:
+  cobj_snap_close(map);
+  return (NULL);
+}
+
+size_t
+cobj_snap_count(cobj_snap_map_t map) {
+
+  return (map->hdr.nobjs);
+}
+
+/*
+ * The i-th object added to the snapshot.
+ */
+cobj_t
+cobj_snap_object(cobj_snap_map_t map, size_t i) {
+
+  if (i >= map->hdr.nobjs)
+    return (NULL);
+
+  return ((cobj_t)(map->base + map->objs[i].off));
+}
+
+/*
+ * Unmap the snapshot and release its classes. Its objects must
+ * not be used afterwards, and must never be passed to
+ * cobj_delete(3).
+ */
+void cobj_snap_close(cobj_snap_map_t map) {
+  u_int c;
+
+  if (map == NULL)
+    return;
+
+  if (map->classes != NULL) {
+    for (c = 0; c < map->hdr.nclasses; c++) {
+      if (map->classes[c] != NULL && cobj_class_unref(map->classes[c]))
+        cobj_class_free(map->classes[c]);
+    }
+    free(map->classes);
+  }
+
+  if (map->base != NULL)
+    (void)munmap(map->base, map->size);
+
+  free(map);
+}
@@ -0,0 +1,62 @@
+# Copyright 2019 Henning Matyschok.
+# All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions
+# are met:
+# 1. Redistributions of source code must retain the above copyright
+#    notice, this list of conditions and the following disclaimer.
+# 2. Redistributions in binary form must reproduce the above copyright
+#    notice, this list of conditions and the following disclaimer in the
+#    documentation and/or other materials provided with the distribution.
+#
+# THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+# ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+# FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+# DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+# OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+# HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+# LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+# OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+# SUCH DAMAGE.
+#
+
+#
+# Specification for the snapshot interface of cobj_snap_create(3).
+#
+
+INTERFACE cobj_snap;
+
+#
+# Default of both methods, for objects without memory
+# of their own.
+#
+CODE {
+	static int
+	cobj_snap_nofix(void)
+	{
+		return (0);
+	}
+};
+
+#
+# Save the memory the object points into with cobj_snap_alloc(3),
+# given the offset of its copy, storing offsets from the start of
+# the file in place of the pointers. Returns 0 on success.
+#
+METHOD int save {
+	cobj_t o;
+	cobj_snap_t snap;
+	u_long off;
+} DEFAULT cobj_snap_nofix;
+
+#
+# Turn the offsets stored by cobj_snap_save back into pointers
+# into the snapshot mapped at base. Returns 0 on success.
+#
+METHOD int load {
+	cobj_t o;
+	void *base;
+} DEFAULT cobj_snap_nofix;
@@ -0,0 +1,264 @@
+/*-
+ * Copyright (c) 2019 Henning Matyschok
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <libcobj.h>
+
+#include "cobj_private.h"
+
+/*
+ * Dispatch statistics.
+ *
+ * Every thread counts into a table of its own, keyed by class and
+ * method descriptor, so that counting never writes a cache line
+ * another thread writes to. Only the owner updates the counters,
+ * readers aggregating a snapshot load them without stopping it.
+ * Tables are never freed, the table of an exited thread is handed
+ * to the next thread asking for one and its counts are kept.
+ */
+
+#define COBJ_STATS_SLOTS 256  /* methods counted per thread */
+#define COBJ_STATS_PROBE 8    /* slots looked at per method */
+
+struct cobj_stats_shard {
+  struct cobj_thread_rec rec;
+  struct cobj_stats slot[COBJ_STATS_SLOTS];
+  struct cobj_stats overflow;       /* methods beyond the slots */
+};
+
+u_int cobj_stats_enabled;
+
+static struct cobj_thread_recs cobj_stats_shards =
+    COBJ_THREAD_RECS(struct cobj_stats_shard, NULL);
+
+static __thread struct cobj_stats_shard *cobj_stats_self;
+
+static struct cobj_stats_shard *
+cobj_stats_shard(void) {
+
+  if (cobj_stats_self == NULL)
+    cobj_stats_self = cobj_thread_rec(&cobj_stats_shards);
+
+  return (cobj_stats_self);
+}
+
+/*
+ * Find the counters of a method of a class in the table of
+ * the calling thread, claiming a free slot for it if needed.
+ * Only COBJ_STATS_PROBE slots are probed, a method which finds
+ * none of them free is counted in the overflow. The descriptor
+ * is stored last, a reader only looks at the class of a slot
+ * once it has seen one.
+ */
+
+static struct cobj_stats *
+cobj_stats_lookup(cobj_class_t cls, cobjop_desc_t desc) {
+  struct cobj_stats_shard *sh;
+  struct cobj_stats *st;
+  u_int i, n;
+
+  if ((sh = cobj_stats_shard()) == NULL)
+    return (NULL);
+
+  i = (u_int)((((uintptr_t)cls >> 4) ^ (uintptr_t)desc) * 0x9e3779b1U) >>
+      24;
+
+  for (n = 0; n < COBJ_STATS_PROBE; n++) {
+    st = &sh->slot[(i + n) % COBJ_STATS_SLOTS];
+
+    if (st->desc == desc && st->cls == cls)
+      return (st);
+
+    if (st->desc == NULL) {
+      st->cls = cls;
+      __atomic_store_n(&st->desc, desc, __ATOMIC_RELEASE);
+      return (st);
+    }
+  }
+
+  return (&sh->overflow);
+}
+
+#define COBJ_STATS_ADD(FIELD, N) \
+  __atomic_store_n(&(FIELD), (FIELD) + (N), __ATOMIC_RELAXED)
+
+void cobj_stats_hit(cobj_class_t cls, cobjop_desc_t desc) {
+  struct cobj_stats *st;
+
+  if ((st = cobj_stats_lookup(cls, desc)) != NULL)
+    COBJ_STATS_ADD(st->hits, 1);
+}
+
+/*
+ * Account a slow path lookup, which took nsec nanoseconds.
+ */
+void cobj_stats_miss(cobj_class_t cls, cobjop_desc_t desc, int deflt,
+                     u_long nsec) {
+  struct cobj_stats *st;
+
+  if ((st = cobj_stats_lookup(cls, desc)) == NULL)
+    return;
+
+  COBJ_STATS_ADD(st->misses, 1);
+  if (deflt)
+    COBJ_STATS_ADD(st->defaults, 1);
+  COBJ_STATS_ADD(st->nsec, nsec);
+}
+
+u_long
+cobj_stats_clock(void) {
+  struct timespec ts;
+
+  (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ((u_long)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+int cobj_stats_enable(int on) {
+
+  return (__atomic_exchange_n(&cobj_stats_enabled, on != 0,
+                              __ATOMIC_RELAXED));
+}
+
+static int
+cobj_stats_cmp(const void *a, const void *b) {
+  const struct cobj_stats *sa = a, *sb = b;
+  uintptr_t ka, kb;
+
+  ka = (uintptr_t)sa->cls;
+  kb = (uintptr_t)sb->cls;
+
+  if (ka == kb) {
+    ka = (uintptr_t)sa->desc;
+    kb = (uintptr_t)sb->desc;
+  }
+
+  return ((ka > kb) - (ka < kb));
+}
+
+static void
+cobj_stats_load(struct cobj_stats *dst, struct cobj_stats *src) {
+
+  dst->hits = __atomic_load_n(&src->hits, __ATOMIC_RELAXED);
+  dst->misses = __atomic_load_n(&src->misses, __ATOMIC_RELAXED);
+  dst->defaults = __atomic_load_n(&src->defaults, __ATOMIC_RELAXED);
+  dst->nsec = __atomic_load_n(&src->nsec, __ATOMIC_RELAXED);
+}
+
+/*
+ * Sum the tables of all threads up into one entry per class and
+ * method. Counts of methods which did not fit into the table of
+ * some thread are reported under a NULL class and descriptor.
+ * Returns the number of entries, of which at most n are stored.
+ */
+size_t
+cobj_stats_snapshot(struct cobj_stats *st, size_t n) {
+  struct cobj_stats_shard *sh;
+  struct cobj_stats *all, *src;
+  size_t nall, nsh, i, j;
+
+  nsh = 0;
+  COBJ_THREAD_FOREACH(sh, &cobj_stats_shards)
+    nsh++;
+
+  if (nsh == 0)
+    return (0);
+
+  if ((all = malloc(nsh * (COBJ_STATS_SLOTS + 1) * sizeof(*all))) == NULL)
+    return (0);
+
+  nall = 0;
+  COBJ_THREAD_FOREACH(sh, &cobj_stats_shards) {
+    if (nsh-- == 0)
+      break;
+
+    for (i = 0; i <= COBJ_STATS_SLOTS; i++) {
+      src = (i < COBJ_STATS_SLOTS) ? &sh->slot[i] : &sh->overflow;
+
+      if (i < COBJ_STATS_SLOTS) {
+        all[nall].desc = __atomic_load_n(&src->desc, __ATOMIC_ACQUIRE);
+        if (all[nall].desc == NULL)
+          continue;
+        all[nall].cls = src->cls;
+      } else {
+        all[nall].desc = NULL;
+        all[nall].cls = NULL;
+      }
+
+      cobj_stats_load(&all[nall], src);
+      if (all[nall].hits + all[nall].misses != 0)
+        nall++;
+    }
+  }
+
+  qsort(all, nall, sizeof(*all), cobj_stats_cmp);
+
+  for (i = 0, j = 0; i < nall; j++) {
+    if (j < n)
+      st[j] = all[i];
+
+    for (i++; i < nall && cobj_stats_cmp(&all[i], &all[i - 1]) == 0; i++) {
+      if (j < n) {
+        st[j].hits += all[i].hits;
+        st[j].misses += all[i].misses;
+        st[j].defaults += all[i].defaults;
+        st[j].nsec += all[i].nsec;
+      }
+    }
+  }
+
+  free(all);
+
+  return (j);
+}
+
+/*
+ * Clear the counters of all threads. Calls made by other threads
+ * while the counters are being cleared may be lost.
+ */
+void cobj_stats_reset(void) {
+  struct cobj_stats_shard *sh;
+  struct cobj_stats *st;
+  u_int i;
+
+  COBJ_THREAD_FOREACH(sh, &cobj_stats_shards) {
+    for (i = 0; i <= COBJ_STATS_SLOTS; i++) {
+      st = (i < COBJ_STATS_SLOTS) ? &sh->slot[i] : &sh->overflow;
+
+      __atomic_store_n(&st->hits, 0, __ATOMIC_RELAXED);
+      __atomic_store_n(&st->misses, 0, __ATOMIC_RELAXED);
+      __atomic_store_n(&st->defaults, 0, __ATOMIC_RELAXED);
+      __atomic_store_n(&st->nsec, 0, __ATOMIC_RELAXED);
+    }
+  }
+}
@@ -0,0 +1,116 @@
+/*-
+ * Copyright (c) 2019 Henning Matyschok
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libcobj.h>
+
+#include "cobj_private.h"
+
+/*
+ * Per-thread records, see cobj_thread_rec(3). A thread links the
+ * records it owns, of any list, and a single key hands them back
+ * when it exits.
+ */
+
+static pthread_key_t cobj_thread_key;
+static pthread_once_t cobj_thread_once = PTHREAD_ONCE_INIT;
+
+static __thread struct cobj_thread_rec *cobj_thread_owned;
+
+static void
+cobj_thread_exit(void *arg) {
+  struct cobj_thread_rec *rec, *next;
+
+  (void)arg;
+
+  for (rec = cobj_thread_owned; rec != NULL; rec = next) {
+    next = rec->owned;
+
+    if (rec->recs->exit != NULL)
+      rec->recs->exit(rec);
+
+    rec->owned = NULL;
+    __atomic_store_n(&rec->inuse, 0, __ATOMIC_RELEASE);
+  }
+
+  cobj_thread_owned = NULL;
+}
+
+static void
+cobj_thread_key_init(void) {
+
+  (void)pthread_key_create(&cobj_thread_key, cobj_thread_exit);
+}
+
+void *
+cobj_thread_rec(struct cobj_thread_recs *recs) {
+  struct cobj_thread_rec *rec;
+  u_int inuse;
+
+  (void)pthread_once(&cobj_thread_once, cobj_thread_key_init);
+
+  /*
+	 * Reuse the record of a thread which has exited.
+	 */
+  for (rec = __atomic_load_n(&recs->head, __ATOMIC_ACQUIRE); rec != NULL;
+       rec = rec->next) {
+    inuse = 0;
+    if (__atomic_compare_exchange_n(&rec->inuse, &inuse, 1, 0,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+      break;
+  }
+
+  if (rec == NULL) {
+    if (posix_memalign((void **)&rec, COBJ_CACHE_LINE, recs->size) != 0)
+      return (NULL);
+
+    memset(rec, 0, recs->size);
+    rec->recs = recs;
+    rec->inuse = 1;
+    rec->next = __atomic_load_n(&recs->head, __ATOMIC_RELAXED);
+
+    while (!__atomic_compare_exchange_n(&recs->head, &rec->next, rec, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+      ;
+  }
+
+  /*
+	 * The key only needs a value for its destructor to run.
+	 */
+  if (cobj_thread_owned == NULL)
+    (void)pthread_setspecific(cobj_thread_key, &cobj_thread_owned);
+
+  rec->owned = cobj_thread_owned;
+  cobj_thread_owned = rec;
+
+  return (rec);
+}
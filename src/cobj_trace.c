@@ -0,0 +1,326 @@
+/*-
+ * Copyright (c) 2019 Henning Matyschok
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <libcobj.h>
+
+#include "cobj_private.h"
+
+/*
+ * Call tracing for the wrappers makeobjops.awk generates with -t.
+ *
+ * Every thread records into a table of its own, keyed by trace
+ * point and class, the number of calls and a histogram of the
+ * sampled call latencies, in power of two nanosecond buckets.
+ * Tables are handed over between threads like the ones of
+ * cobj_stats.c.
+ */
+
+#define COBJ_TRACE_SLOTS 128  /* methods traced per thread */
+
+struct cobj_trace_rec {
+  struct cobj_trace *tp;            /* method */
+  cobj_class_t cls;                 /* class called on */
+  u_long calls;                     /* calls made */
+  u_long samples;                   /* calls timed */
+  u_long nsec;                      /* time spent in timed calls */
+  u_long hist[COBJ_TRACE_BUCKETS];  /* timed calls by log2(nsec) */
+};
+
+struct cobj_trace_shard {
+  struct cobj_thread_rec rec;
+  struct cobj_trace_rec slot[COBJ_TRACE_SLOTS];
+  u_long dropped;                   /* calls beyond the slots */
+};
+
+u_int cobj_trace_enabled;
+
+static u_int cobj_trace_every = 1;
+static struct cobj_thread_recs cobj_trace_shards =
+    COBJ_THREAD_RECS(struct cobj_trace_shard, NULL);
+
+static __thread struct cobj_trace_shard *cobj_trace_self;
+static __thread u_int cobj_trace_countdown;
+static __thread u_int cobj_trace_period;  /* calls a timed one counts for */
+
+static struct cobj_trace_shard *
+cobj_trace_shard(void) {
+
+  if (cobj_trace_self == NULL)
+    cobj_trace_self = cobj_thread_rec(&cobj_trace_shards);
+
+  return (cobj_trace_self);
+}
+
+int cobj_trace_enable(int on) {
+
+  return (__atomic_exchange_n(&cobj_trace_enabled, on != 0,
+                              __ATOMIC_RELAXED));
+}
+
+u_int cobj_trace_sample(u_int every) {
+
+  return (__atomic_exchange_n(&cobj_trace_every, every ? every : 1,
+                              __ATOMIC_RELAXED));
+}
+
+/*
+ * Start of a traced call. Only one call in cobj_trace_every is
+ * timed and recorded, counting for the calls it was picked from.
+ */
+u_long
+cobj_trace_enter(void) {
+  struct timespec ts;
+  u_long t;
+
+  if (cobj_trace_countdown > 1) {
+    cobj_trace_countdown--;
+    return (COBJ_TRACE_UNTIMED);
+  }
+
+  cobj_trace_countdown = __atomic_load_n(&cobj_trace_every, __ATOMIC_RELAXED);
+  cobj_trace_period = cobj_trace_countdown;
+
+  (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+  t = (u_long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+  return (t > COBJ_TRACE_UNTIMED ? t : COBJ_TRACE_UNTIMED + 1);
+}
+
+#define COBJ_TRACE_ADD(FIELD, N) \
+  __atomic_store_n(&(FIELD), (FIELD) + (N), __ATOMIC_RELAXED)
+
+/*
+ * End of a traced call which cobj_trace_enter() returned t for.
+ * The trace point is stored last when a slot is claimed, readers
+ * only look at the class of a slot once they have seen it.
+ */
+void cobj_trace_exit(struct cobj_trace *tp, cobj_class_t cls, u_long t) {
+  struct cobj_trace_shard *sh;
+  struct cobj_trace_rec *tr;
+  struct timespec ts;
+  u_long nsec;
+  u_int i, n, b;
+
+  if (t == COBJ_TRACE_UNTIMED)
+    return;
+
+  if ((sh = cobj_trace_shard()) == NULL)
+    return;
+
+  i = (u_int)((((uintptr_t)cls >> 4) ^ (uintptr_t)tp) * 0x9e3779b1U) >> 25;
+
+  for (n = 0; n < COBJ_TRACE_SLOTS; n++) {
+    tr = &sh->slot[(i + n) % COBJ_TRACE_SLOTS];
+
+    if (tr->tp == tp && tr->cls == cls)
+      break;
+
+    if (tr->tp == NULL) {
+      tr->cls = cls;
+      __atomic_store_n(&tr->tp, tp, __ATOMIC_RELEASE);
+      break;
+    }
+  }
+
+  if (n == COBJ_TRACE_SLOTS) {
+    COBJ_TRACE_ADD(sh->dropped, cobj_trace_period);
+    return;
+  }
+
+  COBJ_TRACE_ADD(tr->calls, cobj_trace_period);
+
+  (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+  nsec = (u_long)ts.tv_sec * 1000000000 + ts.tv_nsec - t;
+
+  b = (nsec > 1) ? (u_int)(8 * sizeof(u_long) - 1 - __builtin_clzl(nsec)) : 0;
+  if (b >= COBJ_TRACE_BUCKETS)
+    b = COBJ_TRACE_BUCKETS - 1;
+
+  COBJ_TRACE_ADD(tr->samples, 1);
+  COBJ_TRACE_ADD(tr->nsec, nsec);
+  COBJ_TRACE_ADD(tr->hist[b], 1);
+}
+
+static int
+cobj_trace_cmp(const void *a, const void *b) {
+  const struct cobj_trace_rec *ta = a, *tb = b;
+  int rv;
+
+  if ((rv = strcmp(ta->tp->intf, tb->tp->intf)) != 0)
+    return (rv);
+
+  if (ta->cls != tb->cls) {
+    if ((rv = strcmp(ta->cls->name, tb->cls->name)) != 0)
+      return (rv);
+    return (((uintptr_t)ta->cls > (uintptr_t)tb->cls) -
+            ((uintptr_t)ta->cls < (uintptr_t)tb->cls));
+  }
+
+  if (ta->tp != tb->tp)
+    return (strcmp(ta->tp->method, tb->tp->method));
+
+  return (0);
+}
+
+static void
+cobj_trace_print(int fd, struct cobj_trace_rec *tr) {
+  u_int b, last;
+
+  dprintf(fd, "  %s_%s: %lu calls", tr->tp->intf, tr->tp->method, tr->calls);
+  if (tr->samples == 0) {
+    dprintf(fd, "\n");
+    return;
+  }
+  dprintf(fd, ", %lu timed, mean %lu ns\n", tr->samples,
+          tr->nsec / tr->samples);
+
+  for (last = COBJ_TRACE_BUCKETS; last > 0 && tr->hist[last - 1] == 0;)
+    last--;
+
+  for (b = 0; b < last; b++) {
+    if (tr->hist[b] != 0)
+      dprintf(fd, "    %12lu ns and up: %lu\n", (b > 0) ? 1UL << b : 0,
+              tr->hist[b]);
+  }
+}
+
+/*
+ * Sum the tables of all threads up and write the counts and
+ * latency histograms to fd, grouped by interface and class.
+ * Either filter may be NULL to match everything. Returns the
+ * number of methods written.
+ */
+int cobj_trace_dump(int fd, const char *intf, cobj_class_t cls) {
+  struct cobj_trace_shard *sh;
+  struct cobj_trace_rec *all, *tr, *src, *prev;
+  size_t nall, nsh, i, j, n;
+  u_long dropped;
+  u_int b;
+
+  nsh = 0;
+  COBJ_THREAD_FOREACH(sh, &cobj_trace_shards)
+    nsh++;
+
+  if (nsh == 0)
+    return (0);
+
+  if ((all = malloc(nsh * COBJ_TRACE_SLOTS * sizeof(*all))) == NULL)
+    return (-1);
+
+  nall = 0;
+  dropped = 0;
+  COBJ_THREAD_FOREACH(sh, &cobj_trace_shards) {
+    if (nsh-- == 0)
+      break;
+
+    dropped += __atomic_load_n(&sh->dropped, __ATOMIC_RELAXED);
+
+    for (i = 0; i < COBJ_TRACE_SLOTS; i++) {
+      src = &sh->slot[i];
+      tr = &all[nall];
+
+      if ((tr->tp = __atomic_load_n(&src->tp, __ATOMIC_ACQUIRE)) == NULL)
+        continue;
+      tr->cls = src->cls;
+
+      if (intf != NULL && strcmp(tr->tp->intf, intf) != 0)
+        continue;
+      if (cls != NULL && tr->cls != cls)
+        continue;
+
+      tr->calls = __atomic_load_n(&src->calls, __ATOMIC_RELAXED);
+      tr->samples = __atomic_load_n(&src->samples, __ATOMIC_RELAXED);
+      tr->nsec = __atomic_load_n(&src->nsec, __ATOMIC_RELAXED);
+      for (b = 0; b < COBJ_TRACE_BUCKETS; b++)
+        tr->hist[b] = __atomic_load_n(&src->hist[b], __ATOMIC_RELAXED);
+      if (tr->calls != 0)
+        nall++;
+    }
+  }
+
+  qsort(all, nall, sizeof(*all), cobj_trace_cmp);
+
+  prev = NULL;
+  for (i = 0, n = 0; i < nall; n++) {
+    tr = &all[i];
+
+    for (j = i + 1; j < nall && cobj_trace_cmp(&all[j], tr) == 0; j++) {
+      tr->calls += all[j].calls;
+      tr->samples += all[j].samples;
+      tr->nsec += all[j].nsec;
+      for (b = 0; b < COBJ_TRACE_BUCKETS; b++)
+        tr->hist[b] += all[j].hist[b];
+    }
+
+    if (prev == NULL || prev->cls != tr->cls ||
+        strcmp(prev->tp->intf, tr->tp->intf) != 0)
+      dprintf(fd, "%s on %s:\n", tr->tp->intf, tr->cls->name);
+    prev = tr;
+
+    cobj_trace_print(fd, tr);
+    i = j;
+  }
+
+  if (dropped != 0 && intf == NULL && cls == NULL)
+    dprintf(fd, "%lu calls not traced, out of slots\n", dropped);
+
+  free(all);
+
+  return ((int)n);
+}
+
+/*
+ * Clear the records of all threads. Calls made by other threads
+ * while they are being cleared may be lost.
+ */
+void cobj_trace_reset(void) {
+  struct cobj_trace_shard *sh;
+  struct cobj_trace_rec *tr;
+  u_int i, b;
+
+  COBJ_THREAD_FOREACH(sh, &cobj_trace_shards) {
+    __atomic_store_n(&sh->dropped, 0, __ATOMIC_RELAXED);
+
+    for (i = 0; i < COBJ_TRACE_SLOTS; i++) {
+      tr = &sh->slot[i];
+
+      __atomic_store_n(&tr->calls, 0, __ATOMIC_RELAXED);
+      __atomic_store_n(&tr->samples, 0, __ATOMIC_RELAXED);
+      __atomic_store_n(&tr->nsec, 0, __ATOMIC_RELAXED);
+      for (b = 0; b < COBJ_TRACE_BUCKETS; b++)
+        __atomic_store_n(&tr->hist[b], 0, __ATOMIC_RELAXED);
+    }
+  }
+}
@@ -0,0 +1,153 @@
+/*-
+ * Copyright (c) 2019 Henning Matyschok
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <libcobj.h>
+
+#include "cobj_private.h"
+
+/*
+ * Vectors.
+ *
+ * The instances are kept in one block from the default allocator,
+ * cls->size bytes apart, which is replaced by a larger one when
+ * the vector grows past its capacity. The vector holds a single
+ * reference on the class for all of them.
+ */
+
+/*
+ * Point the instances [from, to) at the ops table of the class.
+ */
+static int
+cobj_vec_init(cobj_vec_t vec, size_t from, size_t to) {
+  size_t i;
+
+  for (i = from; i < to; i++) {
+    if (cobj_init_ops(cobj_vec_at(vec, i), vec->cls) != 0)
+      return (-1);
+  }
+
+  return (0);
+}
+
+cobj_vec_t
+cobj_vec_create(cobj_class_t cls, size_t n) {
+  cobj_vec_t vec;
+
+  if (cls == NULL)
+    return (NULL);
+
+  if (cls->size < sizeof(struct cobj))
+    return (NULL);
+
+  if ((vec = calloc(1, sizeof(*vec))) == NULL)
+    return (NULL);
+
+  cobj_class_ref(cls, 1);
+
+  if (__atomic_load_n(&cls->ops, __ATOMIC_ACQUIRE) == NULL &&
+      cobj_class_compile(cls) != 0) {
+    if (cobj_class_unref(cls))
+      (void)cobj_class_free(cls);
+    free(vec);
+    return (NULL);
+  }
+
+  vec->cls = cls;
+
+  if (cobj_vec_resize(vec, n) != 0) {
+    cobj_vec_destroy(vec);
+    return (NULL);
+  }
+
+  return (vec);
+}
+
+/*
+ * Change the number of instances to n. New instances are zeroed
+ * and initialized, instances beyond n are dropped. Growing past
+ * the capacity moves all instances, pointers to them taken
+ * before are no longer valid.
+ */
+int cobj_vec_resize(cobj_vec_t vec, size_t n) {
+  size_t cap, size;
+  void *objs;
+
+  if (vec == NULL)
+    return (-1);
+
+  size = vec->cls->size;
+
+  if (n > vec->cap) {
+    cap = (vec->cap != 0) ? vec->cap : 16;
+    while (cap < n)
+      cap *= 2;
+
+    if (cap > (size_t)-1 / size)
+      return (-1);
+
+    if ((objs = cobj_allocator->alloc(cobj_allocator, cap * size)) == NULL)
+      return (-1);
+
+    if (vec->objs != NULL) {
+      memcpy(objs, vec->objs, vec->n * size);
+      cobj_allocator->free(cobj_allocator, vec->objs, vec->cap * size);
+    }
+
+    vec->objs = objs;
+    vec->cap = cap;
+  } else if (n < vec->n)
+    memset(cobj_vec_at(vec, n), 0, (vec->n - n) * size);
+
+  if (n > vec->n && cobj_vec_init(vec, vec->n, n) != 0) {
+    memset(cobj_vec_at(vec, vec->n), 0, (n - vec->n) * size);
+    return (-1);
+  }
+
+  vec->n = n;
+
+  return (0);
+}
+
+void cobj_vec_destroy(cobj_vec_t vec) {
+
+  if (vec == NULL)
+    return;
+
+  if (vec->objs != NULL)
+    cobj_allocator->free(cobj_allocator, vec->objs,
+                         vec->cap * vec->cls->size);
+
+  if (cobj_class_unref(vec->cls))
+    (void)cobj_class_free(vec->cls);
+
+  free(vec);
+}
@@ -0,0 +1,569 @@
+/*-
+ * Copyright (c) 2019 Henning Matyschok
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libcobj.h>
+
+#include "cobj_private.h"
+
+/*
+ * A slab allocator for objects of a fixed size, loosely
+ * modelled after uma(9).
+ */
+
+#define COBJ_MAG_SIZE 64        /* items per magazine */
+#define COBJ_SLAB_SIZE 65536    /* bytes per slab */
+#define COBJ_SLAB_MIN 16        /* items per slab, at least */
+#define COBJ_ZONE_MAX 64        /* zones with per-thread magazines */
+
+/*
+ * Free items on the zone and in slabs are linked
+ * through their first word.
+ */
+struct cobj_item {
+  struct cobj_item *next;
+};
+
+struct cobj_mag {
+  struct cobj_mag *next;
+  int count;
+  void *items[COBJ_MAG_SIZE];
+};
+
+struct cobj_slab {
+  struct cobj_slab *next;
+};
+
+struct cobj_zone {
+  struct cobj_allocator allocator;  /* see cobj_class_zone(3) */
+  size_t size;                      /* item size */
+  u_int id;                         /* per-thread cache, if < COBJ_ZONE_MAX */
+  cobj_zone_init_t *init;           /* constructs items */
+  cobj_zone_fini_t *fini;           /* destructs items */
+  pthread_mutex_t lock;             /* protects the fields below */
+  struct cobj_mag *full;            /* depot, magazines holding items */
+  struct cobj_mag *empty;           /* depot, empty magazines */
+  struct cobj_item *free;           /* unconstructed items */
+  struct cobj_slab *slabs;          /* slabs carved so far */
+};
+
+/*
+ * Per-thread magazines of a zone. Items are taken from alloc
+ * and returned to free, the two are swapped before going to
+ * the depot.
+ */
+struct cobj_zcache {
+  cobj_zone_t zone;
+  struct cobj_mag *alloc;
+  struct cobj_mag *free;
+};
+
+/*
+ * The magazines of a thread, by zone ID.
+ */
+struct cobj_zcaches {
+  struct cobj_thread_rec rec;
+  struct cobj_zcache zc[COBJ_ZONE_MAX];
+};
+
+static void cobj_zone_thread_exit(struct cobj_thread_rec *rec);
+
+static struct cobj_thread_recs cobj_zone_recs =
+    COBJ_THREAD_RECS(struct cobj_zcaches, cobj_zone_thread_exit);
+
+static __thread struct cobj_zcaches *cobj_zone_self;
+
+/*
+ * Zone IDs, those of destroyed zones are handed out again.
+ * The lock also keeps cobj_zone_destroy(3) and exiting threads
+ * from returning the same magazines.
+ */
+static pthread_mutex_t cobj_zone_ids_lock = PTHREAD_MUTEX_INITIALIZER;
+static u_int cobj_zone_next;
+static u_int cobj_zone_nfree;
+static u_int cobj_zone_free_ids[COBJ_ZONE_MAX];
+
+/*
+ * Hand the magazines of an exiting thread back to the depots.
+ */
+
+static void
+cobj_zone_depot_put(cobj_zone_t zone, struct cobj_mag *mag) {
+
+  if (mag == NULL)
+    return;
+
+  if (mag->count > 0) {
+    mag->next = zone->full;
+    zone->full = mag;
+  } else {
+    mag->next = zone->empty;
+    zone->empty = mag;
+  }
+}
+
+static void
+cobj_zone_thread_exit(struct cobj_thread_rec *rec) {
+  struct cobj_zcache *zc;
+  int i;
+
+  pthread_mutex_lock(&cobj_zone_ids_lock);
+
+  for (i = 0; i < COBJ_ZONE_MAX; i++) {
+    zc = &((struct cobj_zcaches *)rec)->zc[i];
+
+    if (zc->zone == NULL)
+      continue;
+
+    pthread_mutex_lock(&zc->zone->lock);
+    cobj_zone_depot_put(zc->zone, zc->alloc);
+    cobj_zone_depot_put(zc->zone, zc->free);
+    pthread_mutex_unlock(&zc->zone->lock);
+
+    zc->zone = NULL;
+    zc->alloc = zc->free = NULL;
+  }
+
+  pthread_mutex_unlock(&cobj_zone_ids_lock);
+}
+
+static struct cobj_zcache *
+cobj_zone_cache(cobj_zone_t zone) {
+  struct cobj_zcache *zc;
+
+  if (zone->id >= COBJ_ZONE_MAX)
+    return (NULL);
+
+  /*
+	 * The magazines are returned when this thread exits.
+	 */
+  if (cobj_zone_self == NULL &&
+      (cobj_zone_self = cobj_thread_rec(&cobj_zone_recs)) == NULL)
+    return (NULL);
+
+  zc = &cobj_zone_self->zc[zone->id];
+  if (zc->zone == NULL)
+    zc->zone = zone;
+
+  return (zc);
+}
+
+/*
+ * Allocator interface, the zone is the allocator.
+ */
+
+static void *
+cobj_zone_allocator_alloc(cobj_allocator_t a, size_t size) {
+
+  (void)size;
+
+  return (cobj_zone_alloc((cobj_zone_t)a));
+}
+
+static void
+cobj_zone_allocator_free(cobj_allocator_t a, void *mem, size_t size) {
+
+  (void)size;
+
+  cobj_zone_free((cobj_zone_t)a, mem);
+}
+
+cobj_zone_t
+cobj_zone_create(size_t size, cobj_zone_init_t *init,
+                 cobj_zone_fini_t *fini) {
+  cobj_zone_t zone;
+
+  if (size == 0)
+    return (NULL);
+
+  if ((zone = calloc(1, sizeof(*zone))) == NULL)
+    return (NULL);
+
+  if (pthread_mutex_init(&zone->lock, NULL) != 0) {
+    free(zone);
+    return (NULL);
+  }
+
+  /*
+	 * Keep items aligned like memory from malloc(3).
+	 */
+  zone->size = (size + sizeof(long double) - 1) &
+               ~(sizeof(long double) - 1);
+  zone->allocator.alloc = cobj_zone_allocator_alloc;
+  zone->allocator.free = cobj_zone_allocator_free;
+  zone->init = init;
+  zone->fini = fini;
+
+  /*
+	 * Only the first COBJ_ZONE_MAX zones alive at a time
+	 * get magazines, the others always go to the depot.
+	 */
+  pthread_mutex_lock(&cobj_zone_ids_lock);
+  if (cobj_zone_nfree > 0)
+    zone->id = cobj_zone_free_ids[--cobj_zone_nfree];
+  else if (cobj_zone_next < COBJ_ZONE_MAX)
+    zone->id = cobj_zone_next++;
+  else
+    zone->id = COBJ_ZONE_MAX;
+  pthread_mutex_unlock(&cobj_zone_ids_lock);
+
+  return (zone);
+}
+
+/*
+ * Destroy a zone which no thread uses any more and whose items
+ * have all been freed. The magazines threads keep for it go back
+ * to the depot and its ID is released, then the items cached are
+ * destructed and the slabs freed.
+ */
+void cobj_zone_destroy(cobj_zone_t zone) {
+  struct cobj_zcaches *zcs;
+  struct cobj_zcache *zc;
+  struct cobj_slab *slab;
+
+  if (zone == NULL)
+    return;
+
+  pthread_mutex_lock(&cobj_zone_ids_lock);
+
+  if (zone->id < COBJ_ZONE_MAX) {
+    COBJ_THREAD_FOREACH(zcs, &cobj_zone_recs) {
+      zc = &zcs->zc[zone->id];
+
+      if (zc->zone != zone)
+        continue;
+
+      cobj_zone_depot_put(zone, zc->alloc);
+      cobj_zone_depot_put(zone, zc->free);
+
+      zc->zone = NULL;
+      zc->alloc = zc->free = NULL;
+    }
+
+    cobj_zone_free_ids[cobj_zone_nfree++] = zone->id;
+  }
+
+  pthread_mutex_unlock(&cobj_zone_ids_lock);
+
+  cobj_zone_drain(zone);
+
+  while ((slab = zone->slabs) != NULL) {
+    zone->slabs = slab->next;
+    free(slab);
+  }
+
+  (void)pthread_mutex_destroy(&zone->lock);
+  free(zone);
+}
+
+/*
+ * Carve a new slab into unconstructed items.
+ */
+
+static int
+cobj_zone_grow(cobj_zone_t zone) {
+  struct cobj_slab *slab;
+  struct cobj_item *item;
+  size_t hdr, len, off;
+
+  hdr = (sizeof(*slab) + sizeof(long double) - 1) &
+        ~(sizeof(long double) - 1);
+  len = COBJ_SLAB_SIZE;
+
+  if (len < hdr + COBJ_SLAB_MIN * zone->size)
+    len = hdr + COBJ_SLAB_MIN * zone->size;
+
+  if ((slab = malloc(len)) == NULL)
+    return (-1);
+
+  slab->next = zone->slabs;
+  zone->slabs = slab;
+
+  for (off = hdr; off + zone->size <= len; off += zone->size) {
+    item = (struct cobj_item *)((char *)slab + off);
+    item->next = zone->free;
+    zone->free = item;
+  }
+
+  return (0);
+}
+
+/*
+ * Allocate from the zone itself, with its lock held.
+ */
+
+static void *
+cobj_zone_alloc_slow(cobj_zone_t zone) {
+  struct cobj_item *item;
+
+  if (zone->free == NULL && cobj_zone_grow(zone) != 0)
+    return (NULL);
+
+  item = zone->free;
+  zone->free = item->next;
+
+  if (zone->init != NULL && (*zone->init)(item, zone->size) != 0) {
+    item->next = zone->free;
+    zone->free = item;
+    return (NULL);
+  }
+
+  return (item);
+}
+
+/*
+ * Fill a magazine with newly constructed items.
+ */
+
+static struct cobj_mag *
+cobj_zone_fill(cobj_zone_t zone) {
+  struct cobj_mag *mag;
+  void *item;
+
+  if ((mag = zone->empty) != NULL)
+    zone->empty = mag->next;
+  else if ((mag = malloc(sizeof(*mag))) == NULL)
+    return (NULL);
+
+  mag->count = 0;
+
+  while (mag->count < COBJ_MAG_SIZE) {
+    if ((item = cobj_zone_alloc_slow(zone)) == NULL)
+      break;
+
+    mag->items[mag->count++] = item;
+  }
+
+  return (mag);
+}
+
+void *
+cobj_zone_alloc(cobj_zone_t zone) {
+  struct cobj_zcache *zc;
+  struct cobj_mag *mag;
+  void *item;
+
+  if (zone == NULL)
+    return (NULL);
+
+  if ((zc = cobj_zone_cache(zone)) != NULL) {
+    /*
+		 * Fast path, take from our own magazines.
+		 */
+    if (zc->alloc == NULL || zc->alloc->count == 0) {
+      mag = zc->alloc;
+      zc->alloc = zc->free;
+      zc->free = mag;
+    }
+
+    if (zc->alloc != NULL && zc->alloc->count > 0) {
+      item = zc->alloc->items[--zc->alloc->count];
+      goto out;
+    }
+  }
+
+  pthread_mutex_lock(&zone->lock);
+
+  /*
+	 * Trade our empty magazine for a full one, or fill
+	 * one from the slabs.
+	 */
+  if (zc != NULL) {
+    if ((mag = zone->full) != NULL)
+      zone->full = mag->next;
+    else
+      mag = cobj_zone_fill(zone);
+
+    if (mag != NULL && mag->count > 0) {
+      if (zc->alloc != NULL) {
+        zc->alloc->next = zone->empty;
+        zone->empty = zc->alloc;
+      }
+
+      zc->alloc = mag;
+
+      pthread_mutex_unlock(&zone->lock);
+
+      item = mag->items[--mag->count];
+      goto out;
+    }
+
+    if (mag != NULL) {
+      mag->next = zone->empty;
+      zone->empty = mag;
+    }
+  }
+
+  item = cobj_zone_alloc_slow(zone);
+
+  pthread_mutex_unlock(&zone->lock);
+
+  if (item == NULL)
+    return (NULL);
+
+out:
+  if (zone->init == NULL)
+    memset(item, 0, zone->size);
+
+  return (item);
+}
+
+void cobj_zone_free(cobj_zone_t zone, void *item) {
+  struct cobj_zcache *zc;
+  struct cobj_mag *mag;
+
+  if (zone == NULL || item == NULL)
+    return;
+
+  if ((zc = cobj_zone_cache(zone)) != NULL) {
+    /*
+		 * Fast path, return to our own magazines.
+		 */
+    if (zc->free == NULL || zc->free->count == COBJ_MAG_SIZE) {
+      mag = zc->free;
+      zc->free = zc->alloc;
+      zc->alloc = mag;
+    }
+
+    if (zc->free != NULL && zc->free->count < COBJ_MAG_SIZE) {
+      zc->free->items[zc->free->count++] = item;
+      return;
+    }
+  }
+
+  pthread_mutex_lock(&zone->lock);
+
+  /*
+	 * Trade a full magazine for an empty one.
+	 */
+  if (zc != NULL) {
+    if ((mag = zone->empty) != NULL)
+      zone->empty = mag->next;
+    else if ((mag = malloc(sizeof(*mag))) != NULL)
+      mag->count = 0;
+
+    if (mag != NULL) {
+      if (zc->free != NULL) {
+        zc->free->next = zone->full;
+        zone->full = zc->free;
+      }
+
+      zc->free = mag;
+
+      pthread_mutex_unlock(&zone->lock);
+
+      mag->items[mag->count++] = item;
+      return;
+    }
+  }
+
+  /*
+	 * No magazine to be had, return the item to the slab.
+	 */
+  if (zone->fini != NULL)
+    (*zone->fini)(item, zone->size);
+
+  ((struct cobj_item *)item)->next = zone->free;
+  zone->free = item;
+
+  pthread_mutex_unlock(&zone->lock);
+}
+
+/*
+ * Destruct the items cached in the depot and return them
+ * to their slabs. Magazines held by threads are not touched.
+ */
+void cobj_zone_drain(cobj_zone_t zone) {
+  struct cobj_mag *mag;
+  struct cobj_item *item;
+
+  if (zone == NULL)
+    return;
+
+  pthread_mutex_lock(&zone->lock);
+
+  while ((mag = zone->full) != NULL) {
+    zone->full = mag->next;
+
+    while (mag->count > 0) {
+      item = mag->items[--mag->count];
+
+      if (zone->fini != NULL)
+        (*zone->fini)(item, zone->size);
+
+      item->next = zone->free;
+      zone->free = item;
+    }
+
+    mag->next = zone->empty;
+    zone->empty = mag;
+  }
+
+  while ((mag = zone->empty) != NULL) {
+    zone->empty = mag->next;
+    free(mag);
+  }
+
+  pthread_mutex_unlock(&zone->lock);
+}
+
+/*
+ * Back the instances of a class with a zone. This has to be
+ * done before the first instance is created, since objects
+ * already allocated with calloc(3) cannot go to the zone.
+ */
+int cobj_class_zone(cobj_class_t cls, cobj_zone_init_t *init,
+                    cobj_zone_fini_t *fini) {
+  cobj_allocator_t prev;
+  cobj_zone_t zone;
+
+  if (cls == NULL)
+    return (-1);
+
+  if (cls->size < sizeof(struct cobj))
+    return (-1);
+
+  if (cobj_class_refs(cls) != 0)
+    return (-1);
+
+  if ((zone = cobj_zone_create(cls->size, init, fini)) == NULL)
+    return (-1);
+
+  prev = NULL;
+  if (!__atomic_compare_exchange_n(&cls->allocator, &prev, &zone->allocator, 0,
+                                   __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    cobj_zone_destroy(zone);
+    return (-1);
+  }
+
+  return (0);
+}
@@ -29,11 +29,6 @@
 #ifndef _COBJ_H_
 #define _COBJ_H_
 
-#include <semaphore.h>
-
-/* XXX: well, ... sem(4)??? */
-extern sem_t cobj_lock;
-
 #define COBJ_ASSERT(what)
 
 /*
@@ -45,6 +40,12 @@ typedef const struct cobj_method cobj_method_t;
 typedef int (*cobjop_t)(void);
 typedef struct cobj_ops *cobj_ops_t;
 typedef struct cobjop_desc *cobjop_desc_t;
+typedef struct cobj_allocator *cobj_allocator_t;
+typedef struct cobj_arena *cobj_arena_t;
+typedef struct cobj_zone *cobj_zone_t;
+typedef struct cobj_snap *cobj_snap_t;
+typedef struct cobj_snap_map *cobj_snap_map_t;
+typedef struct cobj_vec *cobj_vec_t;
 
 struct cobj_method {
   cobjop_desc_t desc;
@@ -56,25 +57,81 @@ struct cobj_method {
  * instance of the class is created, the method table will be compiled
  * into a form more suited to efficient method dispatch. This compiled
  * method table is always the first field of the object.
+ *
+ * The compiled table is published once with an atomic store and the
+ * reference count is maintained atomically, so creating and deleting
+ * objects never serializes on a lock. The busy flag is only set while
+ * cobj_class_free(3) tears down the table of an unused class.
+ *
+ * Instances are counted in per-thread shards which are allocated on
+ * first use, refs only holds the references taken before that and
+ * those pinning a static ops table. The written fields are kept on
+ * their own cache line, away from the read-mostly ones.
  */
-#define COBJ_CLASS_FIELDS                          \
-  const char *name;          /* class name */      \
-  cobj_method_t *methods;    /* method table */    \
-  size_t size;               /* object size */     \
-  cobj_class_t *baseclasses; /* base classes */    \
-  u_int refs;                /* reference count */ \
-  cobj_ops_t ops             /* compiled method table */
+#define COBJ_CACHE_LINE 64
+#define COBJ_ALIGNED __attribute__((__aligned__(COBJ_CACHE_LINE)))
+
+#define COBJ_CLASS_FIELDS                                       \
+  const char *name;             /* class name */                \
+  cobj_method_t *methods;       /* method table */              \
+  size_t size;                  /* object size */               \
+  cobj_class_t *baseclasses;    /* base classes */              \
+  cobj_ops_t ops;               /* compiled method table */     \
+  struct cobj_refs *refshards;  /* sharded reference count */   \
+  u_int flags;                  /* COBJ_CLASS_* compile mode */ \
+  cobj_allocator_t allocator;   /* object allocator */          \
+  struct cobj_isa *isa;         /* ancestry, see cobj_isa(3) */ \
+  u_int cid;                    /* index in cobj_registry */    \
+  u_long refs COBJ_ALIGNED;     /* reference count */           \
+  u_int busy                    /* ops being freed */
 
 struct cobj_class {
   COBJ_CLASS_FIELDS;
 };
 
+/*
+ * Class compile modes.
+ *
+ * A flat class resolves every method reachable through the class
+ * and its base classes when it is compiled, and searches for a slot
+ * hash under which none of them collide. Dispatch of those methods
+ * never misses the cache afterwards.
+ */
+#define COBJ_CLASS_FLAT 0x0001
+
 /*
  * Implementation of cobj.
+ *
+ * With COBJ_COMPACT defined to 16 or 32, and the library built the
+ * same way, an object starts with an index of that many bits into
+ * cobj_registry instead of a pointer to its ops table, which takes
+ * the header of small objects from 8 bytes to 2 or 4. An index is
+ * assigned to a class when its first instance is initialized, at
+ * most COBJ_REGISTRY_SIZE of them; the registry holds the current
+ * table of each. COBJ_OPS() yields the ops table of an object in
+ * either layout, objects with none yield NULL.
  */
+#define COBJ_REGISTRY_SIZE 65536
+
+#if defined(COBJ_COMPACT)
+#if COBJ_COMPACT == 16
+#define COBJ_FIELDS \
+  unsigned short cid
+#else
+#define COBJ_FIELDS \
+  unsigned int cid
+#endif
+
+extern cobj_ops_t cobj_registry[COBJ_REGISTRY_SIZE];
+
+#define COBJ_OPS(OBJ) (cobj_registry[(OBJ)->cid])
+#else
 #define COBJ_FIELDS \
   cobj_ops_t ops
 
+#define COBJ_OPS(OBJ) ((OBJ)->ops)
+#endif /* ! COBJ_COMPACT */
+
 struct cobj {
   COBJ_FIELDS;
 };
@@ -82,18 +139,96 @@ struct cobj {
 /*
  * The ops table is used as a cache of
  * results from cobj_call_method(3).
+ *
+ * The slot of a method is taken from the high bits of its ID
+ * multiplied with a per-table constant. An ordinary table uses
+ * 1 << shift, which is the same as indexing by the low bits of
+ * the ID, a flat table uses the perfect hash found at compile
+ * time.
+ *
+ * The number of slots is a power of two between COBJ_CACHE_MIN
+ * and COBJ_CACHE_SIZE, chosen after the number of methods the
+ * class can reach, and the table is allocated to match.
+ *
+ * Behind the slots, the compiler keeps the linearized resolution
+ * order of the class hierarchy and every method reachable through
+ * it, resolved along that order and sorted by descriptor. A cache
+ * miss is then a binary search instead of a walk of the hierarchy.
+ *
+ * Classes with base classes also keep, for every method which a
+ * class in the resolution order implements, the implementation
+ * following it in that order, see COBJ_CALL_SUPER. The table is
+ * filled at compile time and hashed by class and descriptor.
  */
 
+#define COBJ_CACHE_MIN 8
 #define COBJ_CACHE_SIZE 256
 
+#define COBJ_OPS_FLAT 0x0001  /* all reachable methods resolved */
+#define COBJ_OPS_CONST 0x0002 /* built by makeobjops.awk, read-only */
+
+struct cobj_super {
+  cobj_class_t cls;       /* class overriding the method */
+  cobj_method_t *ce;      /* next implementation after it */
+};
+
+#define COBJ_OPS_FIELDS                                         \
+  cobj_class_t cls;                                             \
+  u_int flags;            /* COBJ_OPS_* */                      \
+  u_int mult;             /* slot hash multiplier */            \
+  u_int shift;            /* slot hash shift */                 \
+  u_int nindex;           /* number of resolved methods */      \
+  u_int nmro;             /* number of classes in mro */        \
+  u_int nsuper;           /* slots in super, a power of two */  \
+  u_long gen;             /* odd, or the address if const */   \
+  cobj_method_t **index;  /* resolved methods, by descriptor */ \
+  cobj_class_t *mro;      /* method resolution order */         \
+  struct cobj_super *super /* next methods, by class */
+
 struct cobj_ops {
-  cobj_method_t *cache[COBJ_CACHE_SIZE];
-  cobj_class_t cls;
+  COBJ_OPS_FIELDS;
+  cobj_method_t *cache[]; /* 1 << (32 - shift) slots */
 };
 
+/*
+ * An ops table with n slots, for the tables which makeobjops.awk
+ * emits into .rodata.
+ */
+#define COBJ_OPS_TABLE(n)      \
+  struct {                     \
+    COBJ_OPS_FIELDS;           \
+    cobj_method_t *cache[n];   \
+  }
+
+/*
+ * Size of an ops table with n slots.
+ */
+#define COBJ_OPS_SIZE(n) \
+  (sizeof(struct cobj_ops) + (n) * sizeof(cobj_method_t *))
+
+/*
+ * Declare static space for an ops table with up to n slots,
+ * to be passed to cobj_class_compile_static(3) as &name.ops
+ * and sizeof(name).
+ */
+#define COBJ_OPS_STATIC(name, n)         \
+  union {                                \
+    struct cobj_ops ops;                 \
+    char space[COBJ_OPS_SIZE(n)];        \
+  } name
+
+#define COBJ_OPS_SLOT(OPS, ID) \
+  (((u_int)(ID) * (OPS)->mult) >> (OPS)->shift)
+
+#define COBJ_SUPER_SLOT(OPS, CLS, ID)                          \
+  ((((u_int)((u_long)(CLS) >> 4) + (u_int)(ID)) * 0x9e3779b1U) >> \
+   (32 - __builtin_ctz((OPS)->nsuper)))
+
 struct cobjop_desc {
   unsigned int id;     /* unique ID */
   cobj_method_t deflt; /* default implementation */
+  unsigned int refs;   /* compiled tables using the ID */
+  const char *name;    /* method name, for diagnostics */
 };
 
 /*
@@ -122,6 +257,15 @@ struct cobjop_desc {
 #define DEFINE_CLASS(name, methods, size) \
   DEFINE_CLASS_0(name, name##_class, methods, size)
 
+/*
+ * Trailing initializers of a class, by field name. A table header
+ * generated by makeobjops.awk from the class' source file redefines
+ * this to install the precompiled ops table and pin it with a
+ * reference, it has to be included between the method tables and
+ * the class definitions.
+ */
+#define COBJ_CLASS_INIT(classvar) , .ops = NULL
+
 /*
  * Define a class with no base classes. Use like this:
  *
@@ -130,7 +274,8 @@ struct cobjop_desc {
 #define DEFINE_CLASS_0(name, classvar, methods, size) \
                                                       \
   struct cobj_class classvar = {                      \
-      #name, methods, size, NULL}
+      #name, methods, size, NULL                      \
+      COBJ_CLASS_INIT(classvar)}
 
 /*
  * Define a class inheriting a single base class. Use like this:
@@ -144,7 +289,8 @@ struct cobjop_desc {
   static cobj_class_t name##_baseclasses[] =          \
       {&base1, NULL};                                 \
   struct cobj_class classvar = {                      \
-      #name, methods, size, name##_baseclasses}
+      #name, methods, size, name##_baseclasses        \
+      COBJ_CLASS_INIT(classvar)}
 
 /*
  * Define a class inheriting two base classes. Use like this:
@@ -159,7 +305,8 @@ struct cobjop_desc {
       {&base1,                                        \
        &base2, NULL};                                 \
   struct cobj_class classvar = {                      \
-      #name, methods, size, name##_baseclasses}
+      #name, methods, size, name##_baseclasses        \
+      COBJ_CLASS_INIT(classvar)}
 
 /*
  * Define a class inheriting three base classes. Use like this:
@@ -175,48 +322,186 @@ struct cobjop_desc {
        &base2,                                        \
        &base3, NULL};                                 \
   struct cobj_class classvar = {                      \
-      #name, methods, size, name##_baseclasses}
+      #name, methods, size, name##_baseclasses        \
+      COBJ_CLASS_INIT(classvar)}
 
 /*
- * Maintain stats on hits/misses in lookup caches.
+ * Ancestry of a class, computed when the class is first compiled
+ * or asked about and kept for good. The display lists the chain
+ * of first base classes from the root down to the class, so that
+ * a class derives from a class at depth d on its own first-base
+ * chain iff it is found at display[d]. Ancestors only reachable
+ * through a second or third base class are kept in a bit set, by
+ * ID. Either test takes the same few loads for any hierarchy.
  */
-#ifdef COBJ_STATS
-extern u_int cobj_lookup_hits;
-extern u_int cobj_lookup_misses;
-#endif
+#define COBJ_ISA_BITS (sizeof(u_long) * 8)
+
+struct cobj_isa {
+  u_int depth;            /* position on the first-base chain */
+  u_int id;               /* bit in the sets of derived classes */
+  u_int nwords;           /* words in mi */
+  cobj_class_t *display;  /* first-base chain, root first */
+  u_long *mi;             /* other ancestors, by id */
+};
+
+#define COBJ_ISA_TEST(ISA, BISA, BASE)                     \
+  (((BISA)->depth <= (ISA)->depth &&                       \
+    (ISA)->display[(BISA)->depth] == (BASE)) ||            \
+   ((BISA)->id < (ISA)->nwords * COBJ_ISA_BITS &&          \
+    (((ISA)->mi[(BISA)->id / COBJ_ISA_BITS] >>             \
+      ((BISA)->id % COBJ_ISA_BITS)) & 1)))
 
 /*
- * Lookup the method in the cache and if
- * it isn't there look it up the slow way.
+ * Dispatch statistics, see cobj_stats_snapshot(3). Cache misses
+ * are counted by the library while statistics are enabled, hits
+ * only by code built with COBJ_STATS, which costs a load and a
+ * branch per call while they are not.
  */
+struct cobj_stats {
+  cobj_class_t cls;     /* class dispatched on */
+  cobjop_desc_t desc;   /* method */
+  u_long hits;          /* found in the cache */
+  u_long misses;        /* looked up by cobj_call_method(3) */
+  u_long defaults;      /* misses resolved to the default */
+  u_long nsec;          /* time spent in lookups */
+};
+
+extern u_int cobj_stats_enabled;
+
 #ifdef COBJ_STATS
-#define COBJ_CALL_METHOD(OPS, OP)                       \
-  do {                                                  \
-    cobjop_desc_t _desc = &OP##_##desc;                 \
-    cobj_method_t **_cep =                              \
-        &OPS->cache[_desc->id & (COBJ_CACHE_SIZE - 1)]; \
-    cobj_method_t *_ce = *_cep;                         \
-    if (_ce->desc != _desc) {                           \
-      _ce = cobj_call_method(OPS->cls,                  \
-                             _cep, _desc);              \
-      cobj_lookup_misses++;                             \
-    } else                                              \
-      cobj_lookup_hits++;                               \
-    _m = _ce->func;                                     \
+#define COBJ_STATS_HIT(OPS, DESC)                               \
+  do {                                                          \
+    if (__builtin_expect(__atomic_load_n(&cobj_stats_enabled,   \
+                                         __ATOMIC_RELAXED), 0)) \
+      cobj_stats_hit((OPS)->cls, (DESC));                       \
   } while (0)
 #else
+#define COBJ_STATS_HIT(OPS, DESC) \
+  do {                            \
+  } while (0)
+#endif /* ! COBJ_STATS */
+
+/*
+ * Call tracing, see cobj_trace_dump(3). The wrappers generated
+ * by makeobjops.awk -t describe each method with a trace point
+ * and bracket the call with COBJ_TRACE_ENTER() and, unless it
+ * returned 0 or COBJ_TRACE_UNTIMED for a call which is not
+ * sampled, cobj_trace_exit(3).
+ */
+#define COBJ_TRACE_BUCKETS 32
+#define COBJ_TRACE_UNTIMED 1
+
+struct cobj_trace {
+  const char *intf;     /* interface name */
+  const char *method;   /* method name */
+};
+
+extern u_int cobj_trace_enabled;
+
+#define COBJ_TRACE_ENTER()                                  \
+  (__builtin_expect(__atomic_load_n(&cobj_trace_enabled,    \
+                                    __ATOMIC_RELAXED), 0)   \
+       ? cobj_trace_enter()                                 \
+       : 0)
+
+/*
+ * Lookup the method in the cache and if
+ * it isn't there look it up the slow way.
+ * OPS is evaluated once, it may be COBJ_OPS().
+ */
 #define COBJ_CALL_METHOD(OPS, OP)                       \
   do {                                                  \
+    cobj_ops_t _cops = (OPS);                           \
     cobjop_desc_t _desc = &OP##_##desc;                 \
     cobj_method_t **_cep =                              \
-        &OPS->cache[_desc->id & (COBJ_CACHE_SIZE - 1)]; \
+        &_cops->cache[COBJ_OPS_SLOT(_cops, _desc->id)]; \
     cobj_method_t *_ce = *_cep;                         \
     if (_ce->desc != _desc)                             \
-      _ce = cobj_call_method(OPS->cls,                  \
+      _ce = cobj_call_method(_cops->cls,                \
                              _cep, _desc);              \
+    else                                                \
+      COBJ_STATS_HIT(_cops, _desc);                     \
     _m = _ce->func;                                     \
   } while (0)
-#endif /* ! COBJ_STATS */
+
+/*
+ * Only the cache probe of COBJ_CALL_METHOD, for the out-of-line
+ * wrappers generated by makeobjops.awk -o: true on a hit, which
+ * sets _m, a miss is left to a function of its own.
+ */
+#define COBJ_PROBE_METHOD(OPS, OP)                          \
+  __extension__({                                           \
+    cobj_ops_t _cops = (OPS);                               \
+    cobjop_desc_t _desc = &OP##_##desc;                     \
+    cobj_method_t *_ce =                                    \
+        _cops->cache[COBJ_OPS_SLOT(_cops, _desc->id)];      \
+    int _hit = __builtin_expect(_ce->desc == _desc, 1);     \
+    if (_hit) {                                             \
+      COBJ_STATS_HIT(_cops, _desc);                         \
+      _m = _ce->func;                                       \
+    }                                                       \
+    _hit;                                                   \
+  })
+
+/*
+ * Call the implementation of a method which follows that of class
+ * CLS in the resolution order of the object's class, for methods
+ * of CLS calling the one they override. The first probe of the
+ * table of the object's class is done here, anything else by
+ * cobj_call_super(3).
+ */
+#define COBJ_CALL_SUPER(CLS, OPS, OP)                           \
+  do {                                                          \
+    cobj_ops_t _sops = (OPS);                                   \
+    cobj_class_t _scls = (CLS);                                 \
+    cobjop_desc_t _sdesc = &OP##_##desc;                        \
+    struct cobj_super *_sp = NULL;                              \
+    if (_sops->nsuper != 0)                                     \
+      _sp = &_sops->super[COBJ_SUPER_SLOT(_sops, _scls,         \
+                                          _sdesc->id)];         \
+    if (_sp != NULL && _sp->cls == _scls &&                     \
+        _sp->ce->desc == _sdesc)                                \
+      _m = _sp->ce->func;                                       \
+    else                                                        \
+      _m = cobj_call_super(_sops, _scls, _sdesc)->func;         \
+  } while (0)
+
+/*
+ * Per call site inline caches, for the wrappers generated by
+ * makeobjops.awk -i. A cache remembers the method resolved for
+ * up to COBJ_IC_WAYS method tables, by their generation, so a
+ * call site which only sees few classes skips the lookup in the
+ * class' table. Entries are filled once and never replaced, a
+ * call site seeing more tables than that is megamorphic and
+ * falls back to the cache of the class, as COBJ_CALL_METHOD.
+ */
+#define COBJ_IC_WAYS 4
+
+struct cobj_ic {
+  u_int n;      /* entries filled */
+  u_int busy;   /* an entry is being filled */
+  struct {
+    u_long gen;
+    cobjop_t func;
+  } e[COBJ_IC_WAYS];
+};
+
+#define COBJ_IC_CALL_METHOD(IC, OPS, OP)                      \
+  do {                                                        \
+    cobj_ops_t _icops = (OPS);                                \
+    u_int _icn = __atomic_load_n(&(IC)->n, __ATOMIC_ACQUIRE); \
+    u_int _ici;                                               \
+    for (_ici = 0; _ici < _icn; _ici++) {                     \
+      if ((IC)->e[_ici].gen == _icops->gen)                   \
+        break;                                                \
+    }                                                         \
+    if (_ici < _icn)                                          \
+      _m = (IC)->e[_ici].func;                                \
+    else if (_icn == COBJ_IC_WAYS)                            \
+      COBJ_CALL_METHOD(_icops, OP);                           \
+    else                                                      \
+      _m = cobj_ic_miss((IC), _icops, &OP##_##desc);          \
+  } while (0)
 
 __BEGIN_DECLS
 /*
@@ -224,17 +509,85 @@ __BEGIN_DECLS
  */
 int cobj_class_compile(cobj_class_t cls);
 
+/*
+ * Compile the method table in a class in the given
+ * mode, see COBJ_CLASS_FLAT. The mode is kept in the
+ * class and also used whenever it is recompiled.
+ */
+int cobj_class_compile_flags(cobj_class_t cls, u_int flags);
+
 /*
  * Compile the method table, with the caller providing the space for
- * the ops table.(for use before malloc is initialised).
+ * the ops table.(for use before malloc is initialised). The table is
+ * made to fit into size bytes, see COBJ_OPS_STATIC.
  */
-int cobj_class_compile_static(cobj_class_t cls, cobj_ops_t ops);
+int cobj_class_compile_static(cobj_class_t cls, cobj_ops_t ops,
+                              size_t size);
+
+/*
+ * Report methods which two base classes implement differently
+ * without the class overriding them, and return their number.
+ */
+int cobj_class_check(cobj_class_t cls);
+
+/*
+ * Report the cache slots of a class which more than one of its
+ * methods map to, and return the number of methods which have to
+ * share a slot. Occupancy is stored in st if not NULL.
+ */
+struct cobj_slot_stats {
+  u_int slots;      /* slots in the table */
+  u_int methods;    /* methods reachable through the class */
+  u_int used;       /* slots at least one method maps to */
+  u_int collisions; /* methods sharing a slot with another */
+};
+
+int cobj_class_slots(cobj_class_t cls, struct cobj_slot_stats *st);
 
 /*
  * Free the compiled method table in a class.
  */
 int cobj_class_free(cobj_class_t cls);
 
+/*
+ * Subtype tests. cobj_class_isa(3) tells whether base is cls or
+ * one of its ancestors, computing the ancestry of either class
+ * if it has not been yet. cobj_isa(3) asks the same of the class
+ * of an object, and COBJ_CAST() converts an object to a pointer
+ * to TYPE if it is an instance of cls, else to NULL.
+ */
+int cobj_class_isa(cobj_class_t cls, cobj_class_t base);
+
+static __inline int
+cobj_isa(cobj_t obj, cobj_class_t cls) {
+  struct cobj_isa *isa, *bisa;
+  cobj_class_t ocls;
+
+  if (obj == (cobj_t)0 || cls == (cobj_class_t)0)
+    return (0);
+
+  ocls = COBJ_OPS(obj)->cls;
+
+  if (ocls == cls)
+    return (1);
+
+  isa = __atomic_load_n(&ocls->isa, __ATOMIC_ACQUIRE);
+  bisa = __atomic_load_n(&cls->isa, __ATOMIC_ACQUIRE);
+
+  if (isa == (struct cobj_isa *)0 || bisa == (struct cobj_isa *)0)
+    return (cobj_class_isa(ocls, cls));
+
+  return (COBJ_ISA_TEST(isa, bisa, cls));
+}
+
+static __inline cobj_t
+cobj_cast(cobj_t obj, cobj_class_t cls) {
+
+  return (cobj_isa(obj, cls) ? obj : (cobj_t)0);
+}
+
+#define COBJ_CAST(TYPE, OBJ, CLS) ((TYPE)cobj_cast((cobj_t)(OBJ), (CLS)))
+
 /*
  * Allocate memory for and initialise a new object.
  */
@@ -251,15 +604,326 @@ int cobj_init_static(cobj_t obj, cobj_class_t cls);
  */
 int cobj_delete(cobj_t obj);
 
+/*
+ * Bound methods.
+ *
+ * Resolve a method of an object once and call it through the
+ * returned function pointer. The generation stored in genp, if
+ * not NULL, identifies the method table the pointer was taken
+ * from; COBJ_BOUND(obj, gen) tells whether the object still
+ * dispatches through it, which is no longer the case after it
+ * has been reinitialised with another class.
+ */
+cobjop_t cobj_bind(cobj_t obj, cobjop_desc_t desc, u_long *genp);
+
+#define COBJ_BOUND(OBJ, GEN) (COBJ_OPS(OBJ)->gen == (GEN))
+
+/*
+ * Resolve a method for an inline cache which missed, and add
+ * the table to it if there is room, see COBJ_IC_CALL_METHOD.
+ */
+cobjop_t cobj_ic_miss(struct cobj_ic *ic, cobj_ops_t ops, cobjop_desc_t desc);
+
+/*
+ * Reorder an array of objects so that objects sharing an ops
+ * table are adjacent, which lets the generated FOO_BAR_BATCH()
+ * wrappers resolve each method once per class.
+ */
+void cobj_sort_by_ops(cobj_t *objs, size_t n);
+
+/*
+ * Allocators.
+ *
+ * Objects are allocated from the allocator of their class, if it
+ * has one, else from the default allocator, which is also used for
+ * compiled method tables. Memory handed out for objects has to be
+ * zeroed, unless the allocator keeps objects constructed. The
+ * default allocator uses calloc(3) and free(3); a replacement has
+ * to be installed before the first class is compiled.
+ */
+struct cobj_allocator {
+  void *(*alloc)(cobj_allocator_t a, size_t size);
+  void (*free)(cobj_allocator_t a, void *mem, size_t size);
+};
+
+void cobj_set_allocator(cobj_allocator_t a);
+int cobj_class_allocator(cobj_class_t cls, cobj_allocator_t a);
+
+/*
+ * Arenas.
+ *
+ * An arena is a bump allocator for request-scoped objects. Objects
+ * created with cobj_create_in(3) are released all at once by
+ * cobj_arena_reset(3) or cobj_arena_destroy(3) and must not be
+ * passed to cobj_delete(3). The arena holds one reference on each
+ * class it has seen instances of until it is reset, so the ops
+ * tables stay valid for as long as the objects do. An arena is not
+ * meant to be shared between threads.
+ */
+cobj_arena_t cobj_arena_create(size_t chunksize);
+cobj_allocator_t cobj_arena_allocator(cobj_arena_t arena);
+void cobj_arena_reset(cobj_arena_t arena);
+void cobj_arena_destroy(cobj_arena_t arena);
+cobj_t cobj_create_in(cobj_arena_t arena, cobj_class_t cls);
+
+/*
+ * Objects in an arena are packed at the alignment their size
+ * allows, so that small objects of mixed classes, in particular
+ * with COBJ_COMPACT headers, are stored like an array of them.
+ * cobj_arena_next(3) walks that array.
+ */
+struct cobj_arena_cursor {
+  void *chunk;
+  size_t off;
+};
+
+cobj_t cobj_arena_next(cobj_arena_t arena, struct cobj_arena_cursor *cur);
+
+/*
+ * Vectors.
+ *
+ * A vector stores instances of a single class back to back,
+ * cls->size bytes apart, as the FOO_BAR_VECTOR() wrappers which
+ * makeobjops.awk generates for a VECTORMETHOD expect them: the
+ * class can process all of them in one call. The vector holds one
+ * reference on the class for its instances, which must not be
+ * passed to cobj_delete(3). A vector is not meant to be shared
+ * between threads while it is resized.
+ */
+struct cobj_vec {
+  cobj_class_t cls;
+  void *objs;   /* first instance */
+  size_t n;     /* instances */
+  size_t cap;   /* instances there is room for */
+};
+
+cobj_vec_t cobj_vec_create(cobj_class_t cls, size_t n);
+int cobj_vec_resize(cobj_vec_t vec, size_t n);
+void cobj_vec_destroy(cobj_vec_t vec);
+
+static __inline cobj_t
+cobj_vec_at(cobj_vec_t vec, size_t i) {
+
+  return ((cobj_t)((char *)vec->objs + i * vec->cls->size));
+}
+
+/*
+ * Object caches.
+ *
+ * A zone hands out fixed-size items carved from slabs. Every thread
+ * keeps a pair of magazines per zone, so that most allocations and
+ * frees touch no shared state. Full and empty magazines are traded
+ * with the zone's depot, an item freed by another thread than the
+ * one which allocated it simply goes into the freeing thread's
+ * magazine and travels back through the depot.
+ *
+ * The optional init hook is called when an item is carved from a
+ * slab, fini when cobj_zone_drain(3) returns it. Items keep their
+ * constructed state while they are cached, a zone without an init
+ * hook hands out zeroed items instead.
+ *
+ * Magazines are kept for up to 64 zones at a time, further zones
+ * go to their depot on every call. cobj_zone_destroy(3) frees a
+ * zone once it is unused and all its items have been freed, and
+ * makes room for another one.
+ */
+typedef int cobj_zone_init_t(void *mem, size_t size);
+typedef void cobj_zone_fini_t(void *mem, size_t size);
+
+cobj_zone_t cobj_zone_create(size_t size, cobj_zone_init_t *init,
+                             cobj_zone_fini_t *fini);
+void *cobj_zone_alloc(cobj_zone_t zone);
+void cobj_zone_free(cobj_zone_t zone, void *item);
+void cobj_zone_drain(cobj_zone_t zone);
+void cobj_zone_destroy(cobj_zone_t zone);
+
+/*
+ * Let cobj_create(3) and cobj_delete(3) take the instances of
+ * the class from a zone of its own, this installs the zone as
+ * the allocator of the class.
+ */
+int cobj_class_zone(cobj_class_t cls, cobj_zone_init_t *init,
+                    cobj_zone_fini_t *fini);
+
+/*
+ * Reclamation of compiled method tables.
+ *
+ * When the last instance of a class is deleted its table is
+ * retired rather than freed, and kept for a grace period in
+ * case the class is instantiated again. Threads which may still
+ * dispatch through instances deleted by other threads bracket
+ * those calls with cobj_epoch_enter(3) and cobj_epoch_exit(3);
+ * a retired table is only freed once every thread has left the
+ * sections it was in when the table was retired. Expired tables
+ * are freed when a table is retired or a class is compiled, else
+ * by cobj_ops_reclaim(3).
+ */
+struct cobj_ops_stats {
+  u_long compiled;  /* tables built by cobj_class_compile(3) */
+  u_long reused;    /* retired tables taken back */
+  u_long retired;   /* tables retired */
+  u_long freed;     /* retired tables freed */
+};
+
+int cobj_epoch_enter(void);
+void cobj_epoch_exit(void);
+void cobj_epoch_synchronize(void);
+u_int cobj_set_grace(u_int msec);
+int cobj_ops_reclaim(void);
+void cobj_ops_stats(struct cobj_ops_stats *st);
+
+/*
+ * Dispatch statistics.
+ *
+ * Counts are kept per thread, per class and per method, and
+ * summed up by cobj_stats_snapshot(3), which returns the number
+ * of entries and stores at most n of them.
+ */
+int cobj_stats_enable(int on);
+size_t cobj_stats_snapshot(struct cobj_stats *st, size_t n);
+void cobj_stats_reset(void);
+void cobj_stats_hit(cobj_class_t cls, cobjop_desc_t desc);
+
+/*
+ * Call tracing.
+ *
+ * While enabled, the wrappers generated with makeobjops.awk -t
+ * time one in every cobj_trace_sample(3) calls, per thread, class
+ * and method, and count the calls from the timed ones.
+ */
+int cobj_trace_enable(int on);
+u_int cobj_trace_sample(u_int every);
+int cobj_trace_dump(int fd, const char *intf, cobj_class_t cls);
+void cobj_trace_reset(void);
+u_long cobj_trace_enter(void);
+void cobj_trace_exit(struct cobj_trace *tp, cobj_class_t cls, u_long t);
+
 /*
  * Call method.
  */
 cobj_method_t *cobj_call_method(cobj_class_t cls,
                                 cobj_method_t **cep,
                                 cobjop_desc_t desc);
+
+/*
+ * Look up the implementation of a method following the one of
+ * cls, see COBJ_CALL_SUPER.
+ */
+cobj_method_t *cobj_call_super(cobj_ops_t ops, cobj_class_t cls,
+                               cobjop_desc_t desc);
+
 /*
  * Default method implementation.
  */
 int cobj_nop(void);
+
+/*
+ * Occupies the unused slots of ops tables, its descriptor
+ * never matches.
+ */
+extern cobj_method_t cobj_null_method;
+
+/*
+ * Asynchronous calls.
+ *
+ * The wrappers generated with makeobjops.awk -a package a call
+ * into a task and hand it to an executor, an object implementing
+ * the cobj_exec_submit method. The task doubles as the future of
+ * the call: its result is collected by the generated foo_bar_await()
+ * or dropped by cobj_future_detach(3). Calls made with
+ * COBJ_ASYNC_ORDERED run one after another, in the order they were
+ * made, for each object.
+ *
+ * The library provides cobj_pool_class, a pool of worker threads
+ * stealing tasks from each other's queues, of which one instance
+ * serves as the default executor unless replaced with
+ * cobj_exec_set_default(3).
+ */
+#define COBJ_ASYNC_ORDERED 0x0001 /* serialize calls per object */
+
+struct cobj_task;
+
+typedef struct cobj_task *cobj_future_t;
+typedef void cobj_task_fn_t(struct cobj_task *t);
+
+struct cobj_task {
+  cobj_task_fn_t *fn;       /* makes the call */
+  struct cobj_task *next;   /* queue linkage */
+  cobj_t obj;               /* object called */
+  size_t size;              /* bytes allocated */
+  u_int flags;              /* COBJ_ASYNC_*, COBJ_TASK_* */
+  u_int state;              /* COBJ_TASK_PENDING etc. */
+};
+
+#define COBJ_TASK_FUTURE 0x0100   /* completes a future */
+
+#define COBJ_TASK_PENDING 0
+#define COBJ_TASK_DONE 1
+#define COBJ_TASK_DETACHED 2
+
+void *cobj_task_alloc(size_t size);
+void cobj_task_run(struct cobj_task *t);
+cobj_future_t cobj_async(cobj_t exec, struct cobj_task *t,
+                         cobj_task_fn_t *fn, cobj_t obj, u_int flags);
+
+int cobj_future_done(cobj_future_t f);
+void cobj_future_wait(cobj_future_t f);
+void cobj_future_free(cobj_future_t f);
+void cobj_future_detach(cobj_future_t f);
+
+/*
+ * Executors implement the cobj_exec_submit method of cobj_exec_if.h,
+ * generated from cobj_exec_if.m: they run every task submitted to
+ * them exactly once, by cobj_task_run(3), or fail the submission.
+ */
+cobj_t cobj_exec_default(void);
+cobj_t cobj_exec_set_default(cobj_t exec);
+
+/*
+ * Work-stealing thread pool, 0 threads is one per online CPU.
+ * Tasks still queued are run before cobj_pool_destroy(3) returns.
+ */
+DECLARE_CLASS(cobj_pool_class);
+
+cobj_t cobj_pool_create(int nthreads);
+int cobj_pool_destroy(cobj_t pool);
+
+/*
+ * Snapshots.
+ *
+ * Objects added to a snapshot are written to a file which
+ * cobj_snap_open(3) maps back in, after a restart, without copying
+ * them: classes are recorded by name and looked up in the NULL
+ * terminated array passed to it, and the objects dispatch through
+ * the snapshot until it is closed. They must never be passed to
+ * cobj_delete(3).
+ *
+ * A class whose instances point into memory of their own saves it
+ * with its cobj_snap_save method, given the offset of the copy of
+ * the object, storing offsets from the start of the file in place
+ * of the pointers, and implements cobj_snap_load to turn them back
+ * into pointers, e.g. with COBJ_SNAP_PTR(). Both are declared in
+ * cobj_snap_if.h, generated from cobj_snap_if.m, and return 0 on
+ * success, the default does nothing.
+ */
+cobj_snap_t cobj_snap_create(void);
+u_long cobj_snap_add(cobj_snap_t snap, cobj_t obj);
+u_long cobj_snap_alloc(cobj_snap_t snap, size_t size);
+void *cobj_snap_at(cobj_snap_t snap, u_long off);
+int cobj_snap_write(cobj_snap_t snap, const char *path);
+void cobj_snap_destroy(cobj_snap_t snap);
+
+cobj_snap_map_t cobj_snap_open(const char *path, cobj_class_t *classes);
+size_t cobj_snap_count(cobj_snap_map_t map);
+cobj_t cobj_snap_object(cobj_snap_map_t map, size_t i);
+void cobj_snap_close(cobj_snap_map_t map);
+
+/*
+ * Turn a pointer P saved as an offset into the snapshot mapped
+ * at BASE back into a pointer, 0 stays NULL.
+ */
+#define COBJ_SNAP_PTR(BASE, P)                                   \
+  ((P) = (__typeof__(P))((P) == 0 ? (char *)0                    \
+                                  : (char *)(BASE) + (u_long)(P)))
 __END_DECLS
 #endif /* !_COBJ_H_ */
@@ -13,8 +13,61 @@ _MATCHES=${_MFILES:${_MATCH}}
 CLEANFILES+=	${_i}
 .endif
 .endfor # _i
+
+# With COBJ_PRECOMPILED, descriptor IDs are assigned at build time and
+# the ops tables of the classes in <file>.c are built into read-only
+# data when <file>_ops.h is listed in SRCS.
+.if defined(COBJ_PRECOMPILED) && ${COBJ_PRECOMPILED:tl} != "no"
+_MFLAGS+=	-s
+CFLAGS+=	-DCOBJ_PRECOMPILED -I${.OBJDIR}
+.endif
+
+# With COBJ_INLINE_CACHE, every call of a generated method wrapper
+# gets an inline cache of its own. COBJ_MFLAGS are passed on to
+# makeobjops.awk as they are, -i only adds the FOO_BAR_IC() wrappers.
+.if defined(COBJ_INLINE_CACHE) && ${COBJ_INLINE_CACHE:tl} != "no"
+_MFLAGS+=	-i
+CFLAGS+=	-DCOBJ_INLINE_CACHE
+.endif
+
+# With COBJ_COMPACT set to 16 or 32 (yes), objects carry an index of
+# that width into the class registry instead of an ops pointer; the
+# library has to be built with the same setting.
+.if defined(COBJ_COMPACT) && ${COBJ_COMPACT:tl} != "no"
+CFLAGS+=	-DCOBJ_COMPACT=${COBJ_COMPACT:S/yes/32/}
+.endif
+
+# With COBJ_ASYNC, FOO_BAR_ASYNC() wrappers queue calls on an executor,
+# see cobj_async(3).
+.if defined(COBJ_ASYNC) && ${COBJ_ASYNC:tl} != "no"
+_MFLAGS+=	-a
+.endif
+_MFLAGS+=	${COBJ_MFLAGS}
+
+# With COBJ_THUNKS, method wrappers are compiled once into <file>_if.c
+# instead of being inlined at every call, with the cache miss path in
+# cold text, trading a call per dispatch for smaller code.
+.if defined(COBJ_THUNKS) && ${COBJ_THUNKS:tl} != "no"
+_MFLAGS+=	-o
+CFLAGS+=	-DCOBJ_THUNKS
+.endif
+
+# With COBJ_TRACE, the generated method wrappers count and time
+# their calls while cobj_trace_enable(3) is on.
+.if defined(COBJ_TRACE) && ${COBJ_TRACE:tl} != "no"
+_MFLAGS+=	-t
+CFLAGS+=	-DCOBJ_TRACE
+.endif
+
+.for _i in ${SRCS:M*_ops.h}
+CLEANFILES+=	${_i}
+${_i}:	${.CURDIR}/${_i:S/_ops.h$/.c/} ${.CURDIR}/../tools/makeobjops.awk
+	${_AWK} -f ${.CURDIR}/../tools/makeobjops.awk \
+	    ${.CURDIR}/${_i:S/_ops.h$/.c/} -h
+.endfor # _i
+
 .m.c:	${.CURDIR}/../tools/makeobjops.awk
-	${_AWK} -f ${.CURDIR}/../tools/makeobjops.awk ${.IMPSRC} -c
+	${_AWK} -f ${.CURDIR}/../tools/makeobjops.awk ${.IMPSRC} -c ${_MFLAGS}
 
 .m.h:	${.CURDIR}/../tools/makeobjops.awk
-	${_AWK} -f ${.CURDIR}/../tools/makeobjops.awk ${.IMPSRC} -h
+	${_AWK} -f ${.CURDIR}/../tools/makeobjops.awk ${.IMPSRC} -h ${_MFLAGS}
@@ -42,9 +42,14 @@
 
 function usage ()
 {
-	print "usage: makeobjops.awk <srcfile.m> [-d] [-p] [-l <nr>] [-c|-h]";
+	print "usage: makeobjops.awk <srcfile.m|class.c> [-d] [-p] [-s] [-t] [-i] [-a] [-o] [-l <nr>] [-c|-h]";
 	print "where -c   produce only .c files";
 	print "      -h   produce only .h files";
+	print "      -s   assign static descriptor IDs at build time";
+	print "      -t   trace method calls, see cobj_trace_dump(3)";
+	print "      -i   add wrappers with per call site inline caches";
+	print "      -a   add wrappers making asynchronous calls";
+	print "      -o   put method wrappers out of line into the .c file";
 	print "      -p   use the path component in the source file for destination dir";
 	print "      -l   set line width for output files [80]";
 	print "      -d   switch on debugging";
@@ -76,6 +81,7 @@ function die (msg)
 #   These are just for convenience ...
 function printc(s) {if (opt_c) print s > ctmpfilename;}
 function printh(s) {if (opt_h) print s > htmpfilename;}
+function printw(s) {if (opt_o) printc(s); else printh(s);}
 
 #
 #   If a line exceeds maxlength, split it into multiple
@@ -300,6 +306,11 @@ function handle_method (static, doc)
 	# the method description 
 	printh("/** @brief Unique descriptor for the " umname "() method */");
 	printh("extern struct cobjop_desc " mname "_desc;");
+	desc_id = "0";
+	if (opt_s) {
+		desc_id = sprintf("%.0fU", static_id(mname));
+		printh("#define " umname "_ID " desc_id);
+	}
 	# the method typedef
 	printh("/** @brief A function implementing the " umname "() method */");
 	prototype = "typedef " ret " " mname "_t(";
@@ -308,34 +319,753 @@ function handle_method (static, doc)
 
 	# Print out the method desc
 	printc("struct cobjop_desc " mname "_desc = {");
-	printc("\t0, { &" mname "_desc, (cobjop_t)" default_function " }");
+	printc("\t.id = " desc_id ",");
+	printc("\t.deflt = { &" mname "_desc, (cobjop_t)" default_function " },");
+	printc("\t.refs = 0,");
+	printc("\t.name = \"" mname "\"");
 	printc("};\n");
 
+	if (opt_t) {
+		printh("extern struct cobj_trace " mname "_trace;");
+		printc("struct cobj_trace " mname "_trace = {");
+		printc("\t\"" intname "\", \"" name "\"");
+		printc("};\n");
+	}
+
 	# Print out the method itself
 	printh(doc);
-	if (0) {		# haven't chosen the format yet
-		printh("static __inline " ret " " umname "(" varname_list ")");
-		printh("\t" join(";\n\t", arguments, num_arguments) ";");
-	}
-	else {
+	if (!static) {
+		firstvar = "((cobj_t)" firstvar ")";
+		firstops = "COBJ_OPS(" firstvar ")";
+	} else
+		firstops = firstvar "->ops";
+
+	if (opt_o) {
+		prototype = ret " " umname "(";
+		printh(format_line(prototype argument_list ");",
+		    line_width, length(prototype)) "\n");
+		handle_thunk(ret);
+	} else {
 		prototype = "static __inline " ret " " umname "(";
 		printh(format_line(prototype argument_list ")",
 		    line_width, length(prototype)));
+		printh("{");
+		printh("\tcobjop_t _m;");
+		if (opt_t)
+			handle_trace(ret);
+		else {
+			printh("\tif (" firstvar " != NULL) {");
+			printh("\t\tCOBJ_CALL_METHOD(" firstops "," mname ");");
+			retrn =  (ret != "void") ? "return " : "";
+			printh("\t\t" retrn "((" mname "_t *) _m)(" varname_list ");");
+			printh("\t}");
+		}
+		printh("}\n");
 	}
+
+	if (!static) {
+		handle_batch(ret);
+		handle_bind();
+		handle_super(ret);
+		if (opt_i)
+			handle_ic(ret);
+		if (opt_a)
+			handle_async(ret);
+	}
+}
+
+#
+#   Emit the inline cache wrapper of a method, see -i. The
+#   FOO_BAR_IC() macro gives every call site a cache of its own,
+#   with COBJ_INLINE_CACHE defined FOO_BAR() is redirected to it.
+#
+
+function handle_ic (ret)
+{
+	printh("/** @brief " umname "() through the inline cache _ic */");
+	prototype = "static __inline " ret " " mname "_ic(";
+	printh(format_line(prototype "struct cobj_ic *_ic, " argument_list ")",
+	    line_width, length(prototype)));
+	printh("{");
+	printh("\tcobjop_t _m;");
+	printh("\tif (" firstvar " != NULL) {");
+	printh("\t\tCOBJ_IC_CALL_METHOD(_ic, COBJ_OPS(" firstvar ")," mname ");");
+	retrn =  (ret != "void") ? "return " : "";
+	printh("\t\t" retrn "((" mname "_t *) _m)(" varname_list ");");
+	printh("\t}");
+	printh("}\n");
+	printh("/** @brief " umname "() through an inline cache of the call site */");
+	printh("#define " umname "_IC(...) __extension__ ({ \\");
+	printh("\tstatic struct cobj_ic _cobj_ic; \\");
+	printh("\t" mname "_ic(&_cobj_ic, __VA_ARGS__); \\");
+	printh("})");
+	printh("#ifdef COBJ_INLINE_CACHE");
+	printh("#define " umname "(...) " umname "_IC(__VA_ARGS__)");
+	printh("#endif\n");
+}
+
+#
+#   Strip the qualifiers of the argument declaration itself, as
+#   in "const int n" or "char *const p", keeping those of what a
+#   pointer points to, so the argument can be stored in a member.
+#
+
+function unqualify (arg,    p, head, tail, n, w, i)
+{
+	if (arg ~ /[[(]/)
+		return (arg);
+	for (p = length(arg); p > 0; p--)
+		if (substr(arg, p, 1) == "*")
+			break;
+	head = substr(arg, 1, p);
+	n = split(substr(arg, p + 1), w);
+	tail = "";
+	for (i = 1; i <= n; i++)
+		if (w[i] != "const" && w[i] != "volatile")
+			tail = tail (tail == "" ? "" : " ") w[i];
+	return (head tail);
+}
+
+#
+#   Emit the asynchronous wrappers of a method, see -a. The
+#   arguments are copied into a task, which is handed to an
+#   executor by cobj_async(3) and makes the call through the
+#   ordinary wrapper; foo_bar_await() collects the result.
+#
+
+function handle_async (ret,    i, avars, rvdecl)
+{
+	avars = "";
+	for (i = 1; i <= num_varnames; i++)
+		avars = avars (i > 1 ? ", " : "") "_a->" varnames[i];
+	rvdecl = ret (ret ~ /\*$/ ? "" : " ") "_rv;";
+
+	printh("/** @brief Arguments and result of an asynchronous " umname "() */");
+	printh("struct " mname "_call {");
+	printh("\tstruct cobj_task _task;");
+	for (i = 1; i <= num_arguments; i++)
+		if (arguments[i])
+			printh("\t" unqualify(arguments[i]) ";");
+	if (ret != "void")
+		printh("\t" rvdecl);
+	printh("};\n");
+
+	printh("/** @brief Make the call queued by " mname "_async() */");
+	printh("static __inline void " mname "_run(struct cobj_task *_t)");
+	printh("{");
+	printh("\tstruct " mname "_call *_a = (struct " mname "_call *)_t;");
+	retrn =  (ret != "void") ? "_a->_rv = " : "";
+	printh("\t" retrn umname "(" avars ");");
+	printh("}\n");
+
+	printh("/** @brief Queue " umname "() on _exec, or the default executor if NULL */");
+	prototype = "static __inline cobj_future_t " mname "_async(";
+	printh(format_line(prototype "cobj_t _exec, u_int _flags, " \
+	    argument_list ")", line_width, length(prototype)));
+	printh("{");
+	printh("\tstruct " mname "_call *_a;");
+	printh("\tif ((_a = (struct " mname "_call *)cobj_task_alloc(sizeof(*_a))) == NULL)");
+	printh("\t\treturn (NULL);");
+	for (i = 1; i <= num_varnames; i++)
+		printh("\t_a->" varnames[i] " = " varnames[i] ";");
+	printh("\treturn (cobj_async(_exec, &_a->_task, " mname "_run, " \
+	    firstvar ", _flags));");
+	printh("}\n");
+
+	printh("/** @brief Wait for an asynchronous " umname "() and free its future */");
+	prototype = "static __inline " ret " " mname "_await(";
+	printh(prototype "cobj_future_t _f)");
+	printh("{");
+	if (ret != "void")
+		printh("\t" rvdecl);
+	printh("\tcobj_future_wait(_f);");
+	if (ret != "void")
+		printh("\t_rv = ((struct " mname "_call *)_f)->_rv;");
+	printh("\tcobj_future_free(_f);");
+	if (ret != "void")
+		printh("\treturn (_rv);");
+	printh("}\n");
+
+	printh("#define " umname "_ASYNC(...) " mname "_async(NULL, 0, __VA_ARGS__)");
+	printh("#define " umname "_ASYNC_ORDERED(...) \\");
+	printh("\t" mname "_async(NULL, COBJ_ASYNC_ORDERED, __VA_ARGS__)\n");
+}
+
+#
+#   Emit the out-of-line wrapper of a method, see -o. Only the
+#   cache probe is made in the wrapper, which tail calls the
+#   method on a hit and, on a miss, a cold function doing the
+#   full COBJ_CALL_METHOD, so that the lookup and the call of
+#   cobj_call_method() are kept out of the hot text. The name
+#   of the wrapper is parenthesized against FOO_BAR() macros.
+#
+
+function handle_thunk (ret,    call)
+{
+	retrn =  (ret != "void") ? "return " : "";
+	call = "((" mname "_t *) _m)(" varname_list ");";
+	if (!opt_t) {
+		printc("static __attribute__((__cold__, __noinline__)) " ret);
+		prototype = mname "_miss(";
+		printc(format_line(prototype argument_list ")",
+		    line_width, length(prototype)));
+		printc("{");
+		printc("\tcobjop_t _m;");
+		printc("\tif (" firstvar " != NULL) {");
+		printc("\t\tCOBJ_CALL_METHOD(" firstops "," mname ");");
+		printc("\t\t" retrn call);
+		printc("\t}");
+		printc("}\n");
+	}
+
+	printc(ret);
+	prototype = "(" umname ")(";
+	printc(format_line(prototype argument_list ")",
+	    line_width, length(prototype)));
+	printc("{");
+	if (opt_t) {
+		printc("\tcobjop_t _m;");
+		handle_trace(ret);
+	} else {
+		printc("\tcobjop_t _m;");
+		printc("\tif (" firstvar " != NULL &&");
+		printc("\t    COBJ_PROBE_METHOD(" firstops "," mname "))");
+		printc("\t\t" retrn call);
+		if (ret == "void")
+			printc("\telse");
+		printc("\t" (ret == "void" ? "\t" : "return ") mname \
+		    "_miss(" varname_list ");");
+	}
+	printc("}\n");
+}
+
+#
+#   Emit the body of a traced method wrapper, see -t. The
+#   class is taken before the call, which may delete the
+#   object.
+#
+
+function handle_trace (ret)
+{
+	printw("\tcobj_ops_t _ops;");
+	printw("\tcobj_class_t _cls;");
+	printw("\tu_long _t;");
+	if (ret != "void")
+		printw("\t" ret (ret ~ /\*$/ ? "" : " ") "_rv;");
+	printw("\tif (" firstvar " != NULL) {");
+	printw("\t\t_ops = " firstops ";");
+	printw("\t\tCOBJ_CALL_METHOD(_ops," mname ");");
+	printw("\t\t_cls = _ops->cls;");
+	printw("\t\t_t = COBJ_TRACE_ENTER();");
+	retrn =  (ret != "void") ? "_rv = " : "";
+	printw("\t\t" retrn "((" mname "_t *) _m)(" varname_list ");");
+	printw("\t\tif (_t > COBJ_TRACE_UNTIMED)");
+	printw("\t\t\tcobj_trace_exit(&" mname "_trace, _cls, _t);");
+	if (ret != "void")
+		printw("\t\treturn _rv;");
+	printw("\t}");
+}
+
+#
+#   Emit the bind helper of a method, returning the typed
+#   function pointer resolved for an object.
+#
+
+function handle_bind ()
+{
+	printh("/** @brief Resolve " umname "() for the object, see cobj_bind(3) */");
+	prototype = "static __inline " mname "_t *" mname "_bind(";
+	printh(format_line(prototype arguments[1] ", u_long *_genp)",
+	    line_width, length(prototype)));
+	printh("{");
+	printh("\treturn ((" mname "_t *)cobj_bind((cobj_t)" varnames[1] \
+	    ", &" mname "_desc, _genp));");
+	printh("}\n");
+}
+
+#
+#   Emit the wrapper calling the implementation of a method
+#   which follows that of a given class, for overriding
+#   methods calling the one they override.
+#
+
+function handle_super (ret)
+{
+	printh("/** @brief Call the " umname "() implementation following that of _cls */");
+	prototype = "static __inline " ret " " umname "_SUPER(";
+	printh(format_line(prototype "cobj_class_t _cls, " argument_list ")",
+	    line_width, length(prototype)));
 	printh("{");
 	printh("\tcobjop_t _m;");
-	
-	if (!static)
-		firstvar = "((cobj_t)" firstvar ")";
-	
 	printh("\tif (" firstvar " != NULL) {");
-	printh("\t\tCOBJ_CALL_METHOD(" firstvar "->ops," mname ");");
+	printh("\t\tCOBJ_CALL_SUPER(_cls, COBJ_OPS(" firstvar ")," mname ");");
 	retrn =  (ret != "void") ? "return " : "";
 	printh("\t\t" retrn "((" mname "_t *) _m)(" varname_list ");");
 	printh("\t}");
 	printh("}\n");
 }
 
+#
+#   Emit the batch wrapper of a method, which calls it on each
+#   object of an array. The method is resolved once for every
+#   run of objects sharing the same ops table, so grouping the
+#   array with cobj_sort_by_ops(3) first pays off.
+#
+
+function handle_batch (ret)
+{
+	firsttype = arguments[1];
+	sub(/[^* 	]+$/, "", firsttype);	# strip the variable name
+	sub(/[ 	]+$/, "", firsttype);
+	batch_args = firsttype (firsttype ~ /\*$/ ? "" : " ") "*_objs, size_t _n";
+	if (ret != "void")
+		batch_args = batch_args ", " ret " *_rv";
+	batch_vars = "_objs[_i]";
+	for (i = 2; i <= num_arguments; i++) {
+		if (!arguments[i])
+			continue;
+		batch_args = batch_args ", " arguments[i];
+	}
+	for (i = 2; i <= num_varnames; i++)
+		batch_vars = batch_vars ", " varnames[i];
+
+	printh("/** @brief Call " umname "() on each of _n objects" \
+	    (ret != "void" ? ", results go to _rv if not NULL" : "") " */");
+	prototype = "static __inline void " umname "_BATCH(";
+	printh(format_line(prototype batch_args ")",
+	    line_width, length(prototype)));
+	printh("{");
+	printh("\tcobjop_t _m = NULL;");
+	printh("\tcobj_ops_t _ops = NULL;");
+	printh("\tsize_t _i;");
+	printh("\tfor (_i = 0; _i < _n; _i++) {");
+	printh("\t\tif (_objs[_i] == NULL)");
+	printh("\t\t\tcontinue;");
+	printh("\t\tif (COBJ_OPS((cobj_t)_objs[_i]) != _ops) {");
+	printh("\t\t\t_ops = COBJ_OPS((cobj_t)_objs[_i]);");
+	printh("\t\t\tCOBJ_CALL_METHOD(_ops," mname ");");
+	printh("\t\t}");
+	if (ret != "void") {
+		printh("\t\tif (_rv != NULL)");
+		printh("\t\t\t_rv[_i] = ((" mname "_t *) _m)(" batch_vars ");");
+		printh("\t\telse");
+		printh("\t\t\t(void)((" mname "_t *) _m)(" batch_vars ");");
+	} else
+		printh("\t\t((" mname "_t *) _m)(" batch_vars ");");
+	printh("\t}");
+	printh("}\n");
+}
+
+#
+#   Handle the vector part of a "VECTORMETHOD" section, which
+#   has been read as a METHOD already. A class may implement
+#   foo_bar_vector to process an array of its own instances in
+#   one call, the default loops over FOO_BAR() for each of them.
+#
+
+function handle_vector (ret,    i, vmname, objtype, rest_args, rest_vars,
+    vargs, vvars, vcall)
+{
+	vmname = mname "_vector";
+	if (methods[vmname]) {
+		warnsrc("Duplicate method name");
+		error = 1;
+		return;
+	}
+	methods[vmname] = vmname;
+
+	objtype = firsttype (firsttype ~ /\*$/ ? "" : " ");
+	rest_args = "";
+	rest_vars = "";
+	for (i = 2; i <= num_arguments; i++)
+		if (arguments[i])
+			rest_args = rest_args ", " arguments[i];
+	for (i = 2; i <= num_varnames; i++)
+		rest_vars = rest_vars ", " varnames[i];
+	vargs = objtype "_objs, size_t _n";
+	vvars = "_objs, _n";
+	if (ret != "void") {
+		vargs = vargs ", " ret " *_rv";
+		vvars = vvars ", _rv";
+	}
+	vargs = vargs rest_args;
+	vvars = vvars rest_vars;
+
+	printh("/** @brief Unique descriptor for the " umname "_VECTOR() method */");
+	printh("extern struct cobjop_desc " vmname "_desc;");
+	desc_id = "0";
+	if (opt_s) {
+		desc_id = sprintf("%.0fU", static_id(vmname));
+		printh("#define " umname "_VECTOR_ID " desc_id);
+	}
+	printh("/** @brief A function implementing " umname "() on _n instances of a class */");
+	prototype = "typedef void " vmname "_t(";
+	printh(format_line(prototype vargs ");",
+	    line_width, length(prototype)));
+	printh("/** @brief The default " vmname ", calling " umname "() on each instance */");
+	prototype = "void " vmname "_scalar(";
+	printh(format_line(prototype vargs ");",
+	    line_width, length(prototype)));
+	printh("");
+
+	printc("struct cobjop_desc " vmname "_desc = {");
+	printc("\t.id = " desc_id ",");
+	printc("\t.deflt = { &" vmname "_desc, (cobjop_t)" vmname "_scalar },");
+	printc("\t.refs = 0,");
+	printc("\t.name = \"" vmname "\"");
+	printc("};\n");
+
+	printc("void");
+	prototype = vmname "_scalar(";
+	printc(format_line(prototype vargs ")",
+	    line_width, length(prototype)));
+	printc("{");
+	printc("\tcobjop_t _m;");
+	printc("\tsize_t _i, _size;");
+	printc("");
+	printc("\tif (_objs == NULL || _n == 0)");
+	printc("\t\treturn;");
+	printc("\t_size = COBJ_OPS((cobj_t)_objs)->cls->size;");
+	printc("\tCOBJ_CALL_METHOD(COBJ_OPS((cobj_t)_objs), " mname ");");
+	printc("\tfor (_i = 0; _i < _n; _i++) {");
+	vcall = "((" mname "_t *) _m)(_objs" rest_vars ");";
+	if (ret != "void") {
+		printc("\t\tif (_rv != NULL)");
+		printc("\t\t\t_rv[_i] = " vcall);
+		printc("\t\telse");
+		printc("\t\t\t(void)" vcall);
+	} else
+		printc("\t\t" vcall);
+	printc("\t\t_objs = (" firsttype ")((char *)_objs + _size);");
+	printc("\t}");
+	printc("}\n");
+
+	printh("/** @brief Call " umname "() on the _n instances of one class at _objs" \
+	    (ret != "void" ? ", results go to _rv if not NULL" : "") " */");
+	prototype = "static __inline void " umname "_VECTOR(";
+	printh(format_line(prototype vargs ")",
+	    line_width, length(prototype)));
+	printh("{");
+	printh("\tcobjop_t _m;");
+	printh("\tif (_objs != NULL && _n != 0) {");
+	printh("\t\tCOBJ_CALL_METHOD(COBJ_OPS((cobj_t)_objs)," vmname ");");
+	printh("\t\t((" vmname "_t *) _m)(" vvars ");");
+	printh("\t}");
+	printh("}\n");
+
+	printh("/** @brief " umname "_VECTOR() on the instances of a cobj_vec_t */");
+	if (ret == "void" && rest_vars == "")
+		printh("#define " umname "_VEC(_v) \\");
+	else
+		printh("#define " umname "_VEC(_v, ...) \\");
+	printh("\t" umname "_VECTOR((" firsttype ")(_v)->objs, (_v)->n" \
+	    ((ret == "void" && rest_vars == "") ? "" : ", __VA_ARGS__") ")\n");
+}
+
+#
+#   Descriptor IDs assigned at build time, see -s. They are
+#   hashed from the method name into the upper half of the ID
+#   space, clear of the IDs cobj(3) hands out at run time.
+#
+
+function static_id (name,    h, i)
+{
+	h = 0;
+	for (i = 1; i <= length(name); i++)
+		h = (h * 31 + ord[substr(name, i, 1)]) % 2147483648;
+	return h + 2147483648;
+}
+
+#
+#   Read a C source file into a single string, without
+#   comments and preprocessor directives.
+#
+
+function read_source (file,    text, line, cont, s, e)
+{
+	text = "";
+	cont = 0;
+	while ((getline line < file) > 0) {
+		if (cont || line ~ /^[ 	]*#/) {
+			cont = (line ~ /\\$/);
+			continue;
+		}
+		text = text line "\n";
+	}
+	close(file);
+
+	while ((s = index(text, "/*")) > 0) {
+		e = index(substr(text, s + 2), "*/");
+		if (!e) {
+			text = substr(text, 1, s - 1);
+			break;
+		}
+		text = substr(text, 1, s - 1) " " substr(text, s + e + 3);
+	}
+	return text;
+}
+
+#
+#   Collect the method tables, marray[table, i] is the name of
+#   the i-th method.  Tables not written with COBJ_METHOD() are
+#   marked with a count of -1.
+#
+
+function parse_methods (text,    name, body, e, k, m)
+{
+	while (match(text, /cobj_method_t[ 	\n]+[A-Za-z_][A-Za-z0-9_]*[ 	\n]*\[[ 	\n]*\][ 	\n]*=[ 	\n]*\{/)) {
+		name = substr(text, RSTART, RLENGTH);
+		text = substr(text, RSTART + RLENGTH);
+		sub(/^cobj_method_t[ 	\n]+/, "", name);
+		sub(/[^A-Za-z0-9_].*$/, "", name);
+
+		e = index(text, "}");
+		body = substr(text, 1, e - 1);
+		text = substr(text, e + 1);
+		if (index(body, "{")) {
+			mcount[name] = -1;
+			continue;
+		}
+
+		k = 0;
+		while (match(body, /COBJ_METHOD[ 	\n]*\([ 	\n]*[A-Za-z_][A-Za-z0-9_]*/)) {
+			m = substr(body, RSTART, RLENGTH);
+			body = substr(body, RSTART + RLENGTH);
+			sub(/^COBJ_METHOD[ 	\n]*\([ 	\n]*/, "", m);
+			marray[name, k++] = m;
+		}
+		mcount[name] = k;
+	}
+}
+
+#
+#   Collect the classes defined with DEFINE_CLASS*().
+#
+
+function parse_classes (text,    call, args, a, c, i, j, depth, nargs, cv)
+{
+	nclasses = 0;
+	while (match(text, /DEFINE_CLASS(_[0-9]+)?[ 	\n]*\(/)) {
+		call = substr(text, RSTART, RLENGTH);
+		cv = (substr(text, 1, RSTART - 1) ~ /static[ 	\n]*$/);
+		text = substr(text, RSTART + RLENGTH);
+
+		#   Split the arguments at the outermost commas.
+		args = "";
+		depth = 1;
+		for (i = 1; i <= length(text); i++) {
+			c = substr(text, i, 1);
+			if (c == "(")
+				depth++;
+			else if (c == ")" && --depth == 0)
+				break;
+			else if (c == "," && depth == 1)
+				c = SUBSEP;
+			args = args c;
+		}
+		text = substr(text, i + 1);
+		nargs = split(args, a, SUBSEP);
+		for (j = 1; j <= nargs; j++) {
+			sub(/^[ 	\n]+/, "", a[j]);
+			sub(/[ 	\n]+$/, "", a[j]);
+		}
+
+		if (call ~ /^DEFINE_CLASS[ 	\n]*\(/) {
+			classes[++nclasses] = a[1] "_class";
+			cmethods[classes[nclasses]] = a[2];
+			cnbases[classes[nclasses]] = 0;
+		} else {
+			classes[++nclasses] = a[2];
+			cmethods[a[2]] = a[3];
+			cnbases[a[2]] = nargs - 4;
+			for (j = 1; j <= nargs - 4; j++)
+				cbase[a[2], j] = a[4 + j];
+		}
+		cstatic[classes[nclasses]] = cv;
+	}
+}
+
+#
+#   Linearize the hierarchy like cobj_class_linearize() does.
+#   Classes whose bases are defined elsewhere can't be resolved
+#   here and are left to be compiled at run time.
+#
+
+function linearize (cv,    i)
+{
+	for (i = 1; i <= nmro; i++)
+		if (mro[i] == cv)
+			return;
+	if (!(cv in cmethods) || cstatic[cv] ||
+	    !(cmethods[cv] in mcount) || mcount[cmethods[cv]] < 0) {
+		unresolved = cv;
+		return;
+	}
+	mro[++nmro] = cv;
+	for (i = 1; i <= cnbases[cv]; i++)
+		linearize(cbase[cv, i]);
+}
+
+#
+#   Find a slot hash under which no two resolved methods collide,
+#   the same one COBJ_OPS_SLOT() computes on 32 bit words.
+#
+
+function flatten (    bits, mult, try, i, slot)
+{
+	for (bits = 3; 2 ^ bits < nres; bits++)
+		;
+	for (; bits <= 8; bits++) {
+		mult = 40503;
+		for (try = 0; try < 1024; try++) {
+			delete used;
+			for (i = 1; i <= nres; i++) {
+				slot = int(((res_id[i] * mult) % 4294967296) / \
+				    2 ^ (32 - bits));
+				if (slot in used)
+					break;
+				used[slot] = i;
+			}
+			if (i > nres) {
+				tbits = bits;
+				tmult = mult;
+				return 1;
+			}
+			mult = (mult * 1103515245 + 12345) % 2097152;
+			if (mult % 2 == 0)
+				mult++;
+		}
+	}
+	return 0;
+}
+
+#
+#   Emit the precompiled ops table of a class, or leave
+#   it to cobj_class_compile(3).
+#
+
+function handle_class (cv,    i, k, arr, m, slots, why)
+{
+	delete mro;
+	delete seen;
+	nmro = 0;
+	nres = 0;
+	unresolved = "";
+	why = "";
+
+	if (!cstatic[cv])
+		linearize(cv);
+	if (cstatic[cv])
+		why = "static class";
+	else if (unresolved != "")
+		why = "can't resolve " unresolved;
+
+	for (i = 1; !why && i <= nmro; i++) {
+		arr = cmethods[mro[i]];
+		for (k = 0; k < mcount[arr]; k++) {
+			m = marray[arr, k];
+			if (m in seen)
+				continue;
+			seen[m] = 1;
+			res_ref[++nres] = "&" arr "[" k "]";
+			res_id[nres] = static_id(m);
+		}
+	}
+	if (!why && (nres > 256 || !flatten()))
+		why = "no collision-free table";
+
+	printh("/* " cv " */");
+	if (why) {
+		warn(src ": " cv ": " why ", compiled at run time");
+		printh("#define " cv "_cobj_ops NULL");
+		printh("#define " cv "_cobj_refs 0\n");
+		return;
+	}
+
+	printh("static cobj_class_t const " cv "_cobj_mro[] = {");
+	for (i = 1; i <= nmro; i++)
+		printh("\t&" mro[i] ",");
+	printh("};\n");
+
+	slots = 2 ^ tbits;
+	printh("static const COBJ_OPS_TABLE(" slots ") " cv "_cobj_table = {");
+	printh("\t&" cv ", COBJ_OPS_FLAT | COBJ_OPS_CONST,");
+	printh(sprintf("\t%.0fU, %d, 0, %d, 0, (u_long)&%s_cobj_table,",
+	    tmult, 32 - tbits, nmro, cv));
+	printh("\tNULL, (cobj_class_t *)" cv "_cobj_mro, NULL, {");
+	for (i = 0; i < slots; i++)
+		printh("\t\t" ((i in used) ? res_ref[used[i]] : "&cobj_null_method") ",");
+	printh("\t}");
+	printh("};\n");
+	printh("#define " cv "_cobj_ops ((cobj_ops_t)&" cv "_cobj_table)");
+	printh("#define " cv "_cobj_refs 1\n");
+}
+
+#
+#   Handle a class source file, producing the header with the
+#   precompiled ops tables of the classes it defines.
+#
+
+function handle_class_file (    text, i, guard)
+{
+	hfilename = src;
+	sub(/\.c$/, "_ops.h", hfilename);
+	if (!opt_p)
+		sub(/^.*\//, "", hfilename);
+	htmpfilename = hfilename ".tmp";
+	if (!opt_h) {
+		warn(src ": class tables are only produced with -h");
+		return;
+	}
+
+	guard = hfilename;
+	sub(/^.*\//, "", guard);
+	gsub(/[^A-Za-z0-9_]/, "_", guard);
+
+	delete mcount;
+	delete marray;
+	delete cmethods;
+	delete cnbases;
+	delete cbase;
+	delete cstatic;
+
+	text = read_source(src);
+	parse_methods(text);
+	parse_classes(text);
+
+	printh("/*\n" \
+	    " * This file is produced automatically.\n" \
+	    " * Do not modify anything in here by hand.\n" \
+	    " *\n" \
+	    " * Created from source file\n" \
+	    " *   " src "\n" \
+	    " * with\n" \
+	    " *   makeobjops.awk\n" \
+	    " *\n" \
+	    " * Include it after the method tables and before the\n" \
+	    " * DEFINE_CLASS() lines. It only matches descriptors\n" \
+	    " * built with -s.\n" \
+	    " */\n");
+	printh("#ifndef _" guard "_");
+	printh("#define _" guard "_\n");
+
+	for (i = 1; i <= nclasses; i++)
+		if (!cstatic[classes[i]])
+			printh("extern struct cobj_class " classes[i] ";");
+	printh("");
+
+	for (i = 1; i <= nclasses; i++)
+		handle_class(classes[i]);
+
+	printh("#undef COBJ_CLASS_INIT");
+	printh("#define COBJ_CLASS_INIT(classvar) \\");
+	printh("\t, .ops = classvar##_cobj_ops, .refs = classvar##_cobj_refs\n");
+	printh("#endif /* _" guard "_ */");
+
+	close(htmpfilename);
+	system_check("mv -f " htmpfilename " " hfilename);
+}
+
 #
 #   Begin of the main program.
 #
@@ -363,6 +1093,11 @@ for (i = 1; i < ARGC; i++) {
 			else if	(o == "h")	opt_h = 1;
 			else if	(o == "p")	opt_p = 1;
 			else if	(o == "d")	opt_d = 1;
+			else if	(o == "s")	opt_s = 1;
+			else if	(o == "t")	opt_t = 1;
+			else if	(o == "i")	opt_i = 1;
+			else if	(o == "a")	opt_a = 1;
+			else if	(o == "o")	opt_o = 1;
 			else if	(o == "l") {
 				if (length(ARGV[i]) > j) {
 					opt_l = substr(ARGV[i], j + 1);
@@ -379,7 +1114,7 @@ for (i = 1; i < ARGC; i++) {
 				usage();
 		}
 	}
-	else if (ARGV[i] ~ /\.m$/)
+	else if (ARGV[i] ~ /\.[mc]$/)
 		filenames[num_files++] = ARGV[i];
 	else
 		usage();
@@ -401,8 +1136,15 @@ if (opt_l) {
 for (i = 0; i < num_files; i++)
 	debug("Filename: " filenames[i]);
 
+for (i = 1; i < 128; i++)
+	ord[sprintf("%c", i)] = i;
+
 for (file_i = 0; file_i < num_files; file_i++) {
 	src = filenames[file_i];
+	if (src ~ /\.c$/) {
+		handle_class_file();
+		continue;
+	}
 	cfilename = hfilename = src;
 	sub(/\.m$/, ".c", cfilename);
 	sub(/\.m$/, ".h", hfilename);
@@ -481,6 +1223,11 @@ for (file_i = 0; file_i < num_files; file_i++) {
 		} else if (/^STATICMETHOD/) {
 			handle_method(1, lastdoc);
 			lastdoc = "";
+		} else if (/^VECTORMETHOD/) {
+			handle_method(0, lastdoc);
+			if (!error)
+				handle_vector(ret);
+			lastdoc = "";
 		} else {
 			debug($0);
 			warnsrc("Invalid line encountered");